@@ -0,0 +1,19 @@
+#version 330 core
+// keeps the visible instances only, packed one after the other in the transform feedback buffer
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+in mat4 vModel[];
+flat in int visible[];
+
+out mat4 instanceModel;
+
+void main()
+{
+    if(visible[0] == 1)
+    {
+        instanceModel = vModel[0];
+        EmitVertex();
+        EndPrimitive();
+    }
+}
@@ -0,0 +1,25 @@
+#version 330 core
+layout (location = 0) in mat4 model;
+
+// bounding sphere of the model, in model space
+uniform vec3 center;
+uniform float radius;
+// normal (inside) and distance of each plane
+uniform vec4 planes[8];
+uniform int planeCount;
+
+out mat4 vModel;
+flat out int visible;
+
+void main()
+{
+    vec3 worldCenter = (model * vec4(center, 1.0)).xyz;
+    float worldRadius = radius * length(model[0].xyz);
+    visible = 1;
+    for(int i = 0; i < planeCount; i++)
+    {
+        if(dot(planes[i].xyz, worldCenter) + planes[i].w < -worldRadius)
+            visible = 0;
+    }
+    vModel = model;
+}
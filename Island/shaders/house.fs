@@ -12,14 +12,12 @@ out vec4 FragColor;
 in vec2 texCoord;
 in vec3 normal;
 in vec3 worldFragPos;
-in vec3 shadowFragPos;
 
 #pragma include Light.glsl
 #pragma include Fog.glsl
+#pragma include shadow.glsl
 
 uniform Material material;
-uniform sampler2D lightDepthTexture;
-uniform sampler2D shadowMap;
 uniform vec3 viewPos;
 uniform Light sun;
 uniform Fog fog;
@@ -35,21 +33,7 @@ void main()
     vec3 diffuse = sun.lightColor * max(dot(Normal, sun.direction), 0.0);
 
     //shadow
-    vec3 shadowSpacePos = shadowFragPos;
-    shadowSpacePos.z -= 0.001f;
-    float shadow = 0.0;
-    for(float x = -0.0005; x <= 0.0005; x+= 0.00025)
-    {
-        for(float y = -0.0005; y <= 0.0005; y+= 0.00025)
-        {
-            float shadowDepth = texture(shadowMap, shadowSpacePos.xy + vec2(x, y)).r;
-            if(shadowDepth > shadowSpacePos.z)
-                shadow += 1.0;
-        }
-    }
-    shadow /= 25.0;// 25 is right
-    if(shadowSpacePos.z > 1.0)
-        shadow = 1.0;
+    float shadow = getShadow(worldFragPos, 0.001, 8, 2.5);
     diffuse *= shadow;
 
     vec3 color = texture(material.texture_diffuse1, texCoord).rgb * (ambient + diffuse);
@@ -8,21 +8,20 @@ layout(location = 4) in vec3 aBitangent;
 out vec2 texCoord;
 out vec3 normal;
 out vec3 worldFragPos;
-out vec3 shadowFragPos;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 shadowMat;
+// water passes only, world space plane keeping the side the pass renders
+uniform vec4 clipPlane;
 
 void main()
 {
     texCoord = aTexCoord;
     vec4 FragPos = model * vec4(aPos, 1.0);
     worldFragPos = FragPos.xyz;
-    vec4 shadowFrag = shadowMat * vec4(worldFragPos, 1.0);
-    shadowFragPos = shadowFrag.xyz;
     gl_Position = projection * view * FragPos;
+    gl_ClipDistance[0] = dot(FragPos, clipPlane);
 
     mat3 normalModel = mat3(inverse(transpose(model)));
     normal = normalModel * aNormal;
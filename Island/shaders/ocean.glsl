@@ -0,0 +1,23 @@
+// must match ocean.h
+const int OCEAN_FFT_SIZE = 128;
+const int OCEAN_GRID_SIZE = 64;
+const int OCEAN_GRID_LEVELS_MAX = 10;
+// cells over which a level blends into the next one before reaching its border
+const float OCEAN_GRID_MORPH = OCEAN_GRID_SIZE / 10.0;
+
+struct OceanGrid {
+    bool enabled; // false: flat quad of the Water model matrix
+    int levels;
+    float spacing;
+    vec2 center;
+    vec2 origins[OCEAN_GRID_LEVELS_MAX];
+    float patchSize;
+    // water rectangle, centered on the origin
+    vec2 halfSize;
+    float height;
+};
+
+// (x displacement, height, z displacement), tiling every patchSize
+uniform sampler2D oceanDisplacement;
+// (dh/dx, dh/dz, Jacobian of the horizontal displacement)
+uniform sampler2D oceanSlopes;
@@ -0,0 +1,44 @@
+// must match SHADOW_CASCADES in shadow_map.h
+const int SHADOW_CASCADES = 3;
+// part of a cascade, in texture coordinates, left at its border so that the filter stays inside it
+const float SHADOW_CASCADE_MARGIN = 0.002;
+
+// One layer per cascade, each one fitted around a slice of the view frustum: the first one is the nearest and sharpest
+uniform sampler2DArrayShadow shadowMap;
+// world space to the texture coordinates and depth of each cascade
+uniform mat4 shadowMats[SHADOW_CASCADES];
+
+// The first cascade that contains the point, SHADOW_CASCADES when none does. shadowCoord is the point in that cascade
+int getShadowCascade(vec3 worldPos, out vec3 shadowCoord)
+{
+    for(int i = 0; i < SHADOW_CASCADES; i++){
+        shadowCoord = (shadowMats[i] * vec4(worldPos, 1.0)).xyz;
+        if(all(greaterThan(shadowCoord.xy, vec2(SHADOW_CASCADE_MARGIN))) && all(lessThan(shadowCoord.xy, vec2(1.0 - SHADOW_CASCADE_MARGIN))) && shadowCoord.z < 1.0)
+            return i;
+    }
+    return SHADOW_CASCADES;
+}
+
+// Part of the light reaching worldPos, 1 out of the cascades. Averages taps hardware PCF fetches (2x2 texels each)
+// spread on a Vogel disk of radius texels, rotated per pixel so that the banding of a small kernel turns into noise
+float getShadow(vec3 worldPos, float bias, int taps, float radius)
+{
+    vec3 shadowCoord;
+    int cascade = getShadowCascade(worldPos, shadowCoord);
+    if(cascade == SHADOW_CASCADES)
+        return 1.0;
+
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    // interleaved gradient noise
+    float rotation = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    float shadow = 0.0;
+    for(int i = 0; i < taps; i++)
+    {
+        // golden angle spiral, evenly covering the disk for any number of taps
+        float r = sqrt((float(i) + 0.5) / float(taps)) * radius;
+        float theta = float(i) * 2.3999632 + rotation;
+        vec2 offset = r * vec2(cos(theta), sin(theta)) * texelSize;
+        shadow += texture(shadowMap, vec4(shadowCoord.xy + offset, float(cascade), shadowCoord.z - bias));
+    }
+    return shadow / float(taps);
+}
@@ -3,14 +3,13 @@ out vec4 FragColor;
 
 in vec2 texCoords;
 in vec3 normal;
-in vec3 shadowFragPos;
 in vec3 worldFragPos;
 
 #pragma include light.glsl
 #pragma include fog.glsl
+#pragma include shadow.glsl
 
 uniform sampler2D terrain;
-uniform sampler2D shadowMap;
 uniform vec3 viewPos;
 uniform Light sun;
 uniform Fog fog;
@@ -27,36 +26,7 @@ void main()
     //shadow
     if((dotLight > 0.0) && (!isRefraction))//skip shadow calculation if a fragment is not facing the sun, or under water surface
     {
-        vec3 shadowSpacePos = shadowFragPos;
-        shadowSpacePos.z -= 0.001f;
-        float shadow = 0.0;
-
-        // for(float x = -0.0005; x <= 0.0005; x+= 0.00025)
-        // {
-        //     for(float y = -0.0005; y <= 0.0005; y+= 0.00025)
-        //     {
-        //         float shadowDepth = texture(shadowMap, shadowSpacePos.xy + vec2(x, y)).r;
-        //         if(shadowDepth > shadowSpacePos.z)
-        //             shadow += 1.0;
-        //     }
-        // }
-        // shadow /= 25.0;
-
-        const float blurSize = 0.00020;//0.00025;
-
-        for(float x = -blurSize; x <= blurSize; x+= blurSize)
-        {
-            for(float y = -blurSize; y <= blurSize; y+= blurSize)
-            {
-                float shadowDepth = texture(shadowMap, shadowSpacePos.xy + vec2(x, y)).r;
-                if(shadowDepth > shadowSpacePos.z)
-                    shadow += 1.0;
-            }
-        }
-        shadow /= 9.0;
-
-        if(shadowSpacePos.z > 1.0)
-            shadow = 1.0;
+        float shadow = getShadow(worldFragPos, 0.001, 5, 1.5);
         diffuse *= shadow;
     }
 
@@ -5,12 +5,13 @@ layout (location = 2) in vec3 aNormal;
 
 out vec2 texCoords;
 out vec3 normal;
-out vec3 shadowFragPos;
 out vec3 worldFragPos;
 
+#pragma include terrain_vertex.glsl
+
+uniform TerrainGrid grid;
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 shadowMat;
 
 uniform float waterHeight;
 uniform bool isRefraction;
@@ -18,20 +19,18 @@ uniform bool isReflection;
 
 void main()
 {
-    texCoords = aTexCoords;
-    normal = aNormal;
-
-    worldFragPos = aPos;
+    vec3 position;
+    getTerrainVertex(grid, aPos, aTexCoords, aNormal, position, texCoords, normal);
 
-    gl_Position = projection * view * vec4(aPos, 1.0);
+    worldFragPos = position;
 
-    vec4 shadowFrag = shadowMat * vec4(aPos, 1.0);
-    shadowFragPos = shadowFrag.xyz;
+    gl_Position = projection * view * vec4(position, 1.0);
 
+    // offsets must match WATER_REFRACTION_CLIP and WATER_REFLECTION_CLIP in camera.h
     if(isRefraction)
     // 䣬ˮϲȾ
-        gl_ClipDistance[0] = dot(vec4(aPos, 1.0), vec4(0.0, -1.0, 0.0, waterHeight + 4.0));
+        gl_ClipDistance[0] = dot(vec4(position, 1.0), vec4(0.0, -1.0, 0.0, waterHeight + 4.0));
     if(isReflection)
     // 䣬ˮ²Ⱦ
-        gl_ClipDistance[0] = dot(vec4(aPos, 1.0), vec4(0.0, 1.0, 0.0, -waterHeight + 0.6));
+        gl_ClipDistance[0] = dot(vec4(position, 1.0), vec4(0.0, 1.0, 0.0, -waterHeight + 0.6));
 }
\ No newline at end of file
@@ -0,0 +1,18 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoords;
+layout (location = 2) in vec3 aNormal;
+
+#pragma include terrain_vertex.glsl
+
+uniform TerrainGrid grid;
+uniform mat4 lightMatrix;
+
+void main()
+{
+    vec3 position;
+    vec2 texCoords;
+    vec3 normal;
+    getTerrainVertex(grid, aPos, aTexCoords, aNormal, position, texCoords, normal);
+    gl_Position = lightMatrix * vec4(position, 1.0);
+}
@@ -0,0 +1,145 @@
+// must match Terrain_Vertex_Format in terrain.h
+const int TERRAIN_VERTEX_FLOAT = 0;
+const int TERRAIN_VERTEX_PACKED = 1;
+const int TERRAIN_VERTEX_HEIGHT_TEXTURE = 2;
+const int TERRAIN_VERTEX_CLIPMAP = 3; // TERRAIN_CLIPMAP_VERTEX_FORMAT of TerrainClipmap
+// must match terrain_clipmap.h
+const int TERRAIN_CLIPMAP_SIZE = 126;
+const int TERRAIN_CLIPMAP_TEXTURE_SIZE = 128;
+const int TERRAIN_CLIPMAP_LEVELS_MAX = 12;
+// cells over which a level blends into the next one before reaching its border
+const float TERRAIN_CLIPMAP_MORPH = TERRAIN_CLIPMAP_SIZE / 10.0;
+
+struct TerrainGrid {
+    int vertexFormat;
+    vec2 size;
+    int cols;
+    int rows;
+    int chunksX;
+    float textureScale;
+    float heightMin;
+    float heightRange;
+    float skirtDepth;
+    // clipmap only: first sample of each level in its own samples, camera position (x, z)
+    int clipmapLevels;
+    float clipmapSpacing;
+    vec2 clipmapCenter;
+    vec2 clipmapOrigins[TERRAIN_CLIPMAP_LEVELS_MAX];
+};
+
+// R16 heights, 0..1 for heightMin..heightMin + heightRange, only bound with TERRAIN_VERTEX_HEIGHT_TEXTURE
+uniform sampler2D terrainHeights;
+
+float getTerrainHeight(TerrainGrid grid, ivec2 vertex){
+    vertex = clamp(vertex, ivec2(0), ivec2(grid.cols - 1, grid.rows - 1));
+    return grid.heightMin + texelFetch(terrainHeights, vertex, 0).r * grid.heightRange;
+}
+
+// one R16 layer per clipmap level, vertex (x, z) of a level is stored toroidally at (x, z) mod TERRAIN_CLIPMAP_TEXTURE_SIZE
+uniform sampler2DArray terrainClipmap;
+
+float getClipmapHeight(TerrainGrid grid, int level, ivec2 vertex){
+    ivec2 texel = vertex & (TERRAIN_CLIPMAP_TEXTURE_SIZE - 1);
+    return grid.heightMin + texelFetch(terrainClipmap, ivec3(texel, level), 0).r * grid.heightRange;
+}
+
+// Height the next level gives to a vertex of this one, interpolated along the same triangles as the mesh
+float getClipmapCoarseHeight(TerrainGrid grid, int level, ivec2 vertex){
+    ivec2 coarse = vertex >> 1;
+    ivec2 odd = vertex & 1;
+    if(odd.x == 1 && odd.y == 1)
+        return 0.5 * (getClipmapHeight(grid, level + 1, coarse + ivec2(1, 0)) + getClipmapHeight(grid, level + 1, coarse + ivec2(0, 1)));
+    return 0.5 * (getClipmapHeight(grid, level + 1, coarse) + getClipmapHeight(grid, level + 1, coarse + odd));
+}
+
+// Central differences, one-sided at the border of the level
+vec3 getClipmapNormal(TerrainGrid grid, int level, ivec2 vertex){
+    ivec2 origin = ivec2(grid.clipmapOrigins[level]);
+    ivec2 low = max(vertex - 1, origin), high = min(vertex + 1, origin + TERRAIN_CLIPMAP_SIZE);
+    float spacing = grid.clipmapSpacing * float(1 << level);
+    float dx = (getClipmapHeight(grid, level, ivec2(high.x, vertex.y)) - getClipmapHeight(grid, level, ivec2(low.x, vertex.y))) / (float(high.x - low.x) * spacing);
+    float dz = (getClipmapHeight(grid, level, ivec2(vertex.x, high.y)) - getClipmapHeight(grid, level, ivec2(vertex.x, low.y))) / (float(high.y - low.y) * spacing);
+    return normalize(vec3(-dx, 1.0, -dz));
+}
+
+// gl_VertexID gives the level and the vertex inside it. Near its border, a level morphs into the next one,
+// so that its outer vertices lie exactly on the edges of the next level and no crack shows
+void getClipmapVertex(TerrainGrid grid, out vec3 position, out vec2 texCoords, out vec3 normal){
+    const int M = TERRAIN_CLIPMAP_SIZE;
+    int level = gl_VertexID / ((M + 1) * (M + 1));
+    int local = gl_VertexID - level * (M + 1) * (M + 1);
+    ivec2 vertex = ivec2(grid.clipmapOrigins[level]) + ivec2(local % (M + 1), local / (M + 1));
+    float spacing = grid.clipmapSpacing * float(1 << level);
+
+    float height = getClipmapHeight(grid, level, vertex);
+    normal = getClipmapNormal(grid, level, vertex);
+    if(level + 1 < grid.clipmapLevels){
+        vec2 distance = abs(vec2(vertex) - grid.clipmapCenter / spacing);
+        float alpha = clamp((max(distance.x, distance.y) - (M / 2 - 2 - TERRAIN_CLIPMAP_MORPH)) / TERRAIN_CLIPMAP_MORPH, 0.0, 1.0);
+        height = mix(height, getClipmapCoarseHeight(grid, level, vertex), alpha);
+        normal = normalize(mix(normal, getClipmapNormal(grid, level + 1, vertex >> 1), alpha));
+    }
+    position = vec3(vec2(vertex) * spacing, height).xzy;
+    texCoords = position.xz * grid.textureScale;
+}
+
+// must match TERRAIN_CHUNK_SIZE / TERRAIN_CHUNK_VERTICES in terrain.h
+const int TERRAIN_CHUNK_SIZE = 64;
+const int TERRAIN_CHUNK_VERTICES = (TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1) + 4 * (TERRAIN_CHUNK_SIZE + 1);
+
+vec3 decodeOctahedral(vec2 encoded){
+    vec2 octahedral = encoded * 2.0 - 1.0;
+    vec3 normal = vec3(octahedral, 1.0 - abs(octahedral.x) - abs(octahedral.y));
+    if(normal.z < 0.0)
+        normal.xy = (1.0 - abs(normal.yx)) * vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(normal);
+}
+
+// Float vertices are passed through. Packed vertices only hold the normalized height (aPos.x) and the octahedral normal (aNormal.xy),
+// the grid position comes from gl_VertexID, which includes the base vertex of the chunk.
+// With the height texture there are no attributes at all, the height is fetched and the normal is taken from central differences
+void getTerrainVertex(TerrainGrid grid, vec3 aPos, vec2 aTexCoords, vec3 aNormal, out vec3 position, out vec2 texCoords, out vec3 normal){
+    if(grid.vertexFormat == TERRAIN_VERTEX_FLOAT){
+        position = aPos;
+        texCoords = aTexCoords;
+        normal = aNormal;
+        return;
+    }
+    if(grid.vertexFormat == TERRAIN_VERTEX_CLIPMAP){
+        getClipmapVertex(grid, position, texCoords, normal);
+        return;
+    }
+
+    const int N = TERRAIN_CHUNK_SIZE;
+    int chunk = gl_VertexID / TERRAIN_CHUNK_VERTICES;
+    int local = gl_VertexID - chunk * TERRAIN_CHUNK_VERTICES;
+    ivec2 cell; // (column, row) inside the chunk
+    bool skirt = local >= (N + 1) * (N + 1);
+    if(!skirt)
+        cell = ivec2(local % (N + 1), local / (N + 1));
+    else{
+        // skirts, edges in order: north, east, south, west
+        int edge = (local - (N + 1) * (N + 1)) / (N + 1);
+        int k = (local - (N + 1) * (N + 1)) % (N + 1);
+        cell = edge == 0 ? ivec2(k, 0) : edge == 1 ? ivec2(N, k) : edge == 2 ? ivec2(k, N) : ivec2(0, k);
+    }
+    ivec2 vertex = min(ivec2(chunk % grid.chunksX, chunk / grid.chunksX) * N + cell, ivec2(grid.cols - 1, grid.rows - 1));
+    vec2 scale = vec2(vertex) / vec2(grid.cols - 1, grid.rows - 1) - 0.5;
+
+    texCoords = scale * grid.textureScale;
+    if(grid.vertexFormat == TERRAIN_VERTEX_PACKED){
+        position = vec3(scale.x * grid.size.x, grid.heightMin + aPos.x * grid.heightRange, scale.y * grid.size.y);
+        normal = decodeOctahedral(aNormal.xy);
+        return;
+    }
+
+    float height = getTerrainHeight(grid, vertex);
+    position = vec3(scale.x * grid.size.x, skirt ? height - grid.skirtDepth : height, scale.y * grid.size.y);
+    // one-sided at the borders of the heightmap
+    ivec2 left = max(vertex - ivec2(1, 0), ivec2(0)), right = min(vertex + ivec2(1, 0), ivec2(grid.cols - 1, grid.rows - 1));
+    ivec2 up = max(vertex - ivec2(0, 1), ivec2(0)), down = min(vertex + ivec2(0, 1), ivec2(grid.cols - 1, grid.rows - 1));
+    vec2 cellSize = grid.size / vec2(grid.cols - 1, grid.rows - 1);
+    float dx = (getTerrainHeight(grid, right) - getTerrainHeight(grid, left)) / (float(right.x - left.x) * cellSize.x);
+    float dz = (getTerrainHeight(grid, down) - getTerrainHeight(grid, up)) / (float(down.y - up.y) * cellSize.y);
+    normal = normalize(vec3(-dx, 1.0, -dz));
+}
@@ -4,15 +4,14 @@ out vec4 FragColor;
 in vec2 texCoord;
 in vec3 normal;
 in vec3 worldFragPos;
-in vec3 shadowFragPos;
 
 #pragma include Light.glsl
 #pragma include Fog.glsl
+#pragma include shadow.glsl
 
 uniform sampler2D texturez;
 uniform vec3 viewPos;
 uniform Light sun;
-uniform sampler2D shadowMap;
 uniform Fog fog;
 
 void main()
@@ -32,35 +31,7 @@ void main()
     vec3 specular = spec * sun.lightColor;
 
     //shadow
-    vec3 shadowSpacePos = shadowFragPos;
-    shadowSpacePos.z -= 0.001f;
-    float shadow = 0.0;
-
-    // for(float x = -0.0005; x <= 0.0005; x+= 0.00025)
-    // {
-    //     for(float y = -0.0005; y <= 0.0005; y+= 0.00025)
-    //     {
-    //         float shadowDepth = texture(shadowMap, shadowSpacePos.xy + vec2(x, y)).r;
-    //         if(shadowDepth > shadowSpacePos.z)
-    //             shadow += 1.0;
-    //     }
-    // }
-    // shadow /= 25.0;// 25 is right
-
-    const float blurSize = 0.00020;//0.00025;
-    for(float x = -blurSize; x <= blurSize; x+= blurSize)
-    {
-        for(float y = -blurSize; y <= blurSize; y+= blurSize)
-        {
-            float shadowDepth = texture(shadowMap, shadowSpacePos.xy + vec2(x, y)).r;
-            if(shadowDepth > shadowSpacePos.z)
-                shadow += 1.0;
-        }
-    }
-    shadow /= 9.0;
-
-    if(shadowSpacePos.z > 1.0)
-        shadow = 1.0;
+    float shadow = getShadow(worldFragPos, 0.001, 5, 1.5);
     vec3 lighting = (diffuse + specular) * shadow;
 
     vec3 color = sampled.rgb * (ambient + lighting);
@@ -7,12 +7,12 @@ layout (location = 3) in mat4 model;
 out vec2 texCoord;
 out vec3 normal;
 out vec3 worldFragPos;
-out vec3 shadowFragPos;
 
 uniform mat4 view;
 uniform mat4 projection;
 uniform float time;
-uniform mat4 shadowMat;
+// water passes only, world space plane keeping the side the pass renders
+uniform vec4 clipPlane;
 
 void main()
 {
@@ -25,9 +25,8 @@ void main()
     }
     vec4 FragPos = model * vec4(pos, 1.0);
     worldFragPos = FragPos.xyz;
-    vec4 shadowFrag = shadowMat * vec4(worldFragPos, 1.0);
-    shadowFragPos = shadowFrag.xyz;
     gl_Position = projection * view * FragPos;
+    gl_ClipDistance[0] = dot(FragPos, clipPlane);
     //gl_Position = projection * view * model * vec4(aPos, 1.0);
 
     mat3 normalModel = mat3(inverse(transpose(model)));
@@ -4,55 +4,173 @@ out vec4 FragColor;
 in vec4 projectionPos;
 in vec2 texcoord;
 in vec3 worldFragPos;
+in vec2 oceanCoord;
 
 #pragma include light.glsl
 #pragma include fog.glsl
+#pragma include ocean.glsl
 
 uniform sampler2D refraction;
 uniform sampler2D dudvMap;
 uniform sampler2D reflection;
 uniform sampler2D normalMap;
+// part of the refraction / reflection textures their passes rendered to, below 1 with a dynamic resolution
+uniform vec2 refractionScale;
+uniform vec2 reflectionScale;
 
 uniform float time;
 uniform vec3 viewPos;
 
 uniform Light sun;
 uniform Fog fog;
+uniform OceanGrid ocean;
+
+// SSR instead of the reflection pass: the screen before the water (copied by Water::render()), and the sky where the rays miss
+uniform bool ssr;
+uniform sampler2D sceneColor;
+uniform sampler2D sceneDepth;
+uniform samplerCube skyboxDiurnal;
+uniform samplerCube skyboxNocturnal;
+uniform float coeDiurnal;
+uniform mat4 view;
+uniform mat4 projection;
 
 const float DISTORTION_SCALE = 0.01;
 const float WAVE_SCALE = 0.03;
+// FFT surface: distortion of the refraction / reflection per unit of slope, Jacobian under which the waves get foam,
+// and how far below it the foam is full
+const float OCEAN_DISTORTION_SCALE = 0.05;
+const float OCEAN_FOAM_JACOBIAN = 0.85;
+const float OCEAN_FOAM_RANGE = 0.1;
+const vec3 OCEAN_FOAM_COLOR = vec3(0.85, 0.9, 0.92);
+// SSR: the ray steps grow geometrically from the first one (world units), a crossing is refined by bisection.
+// A sample more than SSR_THICKNESS steps behind the depth buffer is taken as passing behind an object, not hitting it
+const int SSR_STEPS = 24;
+const int SSR_REFINE_STEPS = 5;
+const float SSR_FIRST_STEP = 0.5;
+const float SSR_STEP_GROWTH = 1.25;
+const float SSR_THICKNESS = 2.0;
+// part of the screen over which the hits fade into the sky near its borders
+const float SSR_EDGE_FADE = 0.1;
 //const vec3 OCEAN_BLUE = vec3(0.0078, 0.2157, 1.0);
 
+// The passes may be rendered at a lower resolution than the screen: bilinear upsampling, kept inside the rendered part
+vec3 samplePass(sampler2D pass, vec2 scale, vec2 texCoord)
+{
+    vec2 halfTexel = 0.5 / vec2(textureSize(pass, 0));
+    return texture(pass, clamp(texCoord * scale, halfTexel, scale - halfTexel)).rgb;
+}
+
+// Distance to the camera plane of the scene at texCoord
+float getSceneDistance(vec2 texCoord)
+{
+    float ndcDepth = texture(sceneDepth, texCoord).r * 2.0 - 1.0;
+    return projection[3][2] / (ndcDepth + projection[2][2]);
+}
+
+vec2 getScreenCoord(vec3 viewPosition)
+{
+    vec4 clipPosition = projection * vec4(viewPosition, 1.0);
+    return clipPosition.xy / clipPosition.w * 0.5 + 0.5;
+}
+
+// Marches the ray (world space) in view space against the depth of the scene. Returns how much the hit can be trusted,
+// 0 for a miss, and its screen coordinates in hitCoord
+float traceReflection(vec3 origin, vec3 direction, out vec2 hitCoord)
+{
+    vec3 previous = (view * vec4(origin, 1.0)).xyz;
+    vec3 rayDirection = mat3(view) * direction;
+    float stepLength = SSR_FIRST_STEP;
+    float nearPlane = projection[3][2] / (projection[2][2] - 1.0);
+    hitCoord = vec2(0.0);
+    for(int i = 0; i < SSR_STEPS; i++){
+        vec3 current = previous + rayDirection * stepLength;
+        vec2 coord = getScreenCoord(current);
+        if(-current.z < nearPlane || any(lessThan(coord, vec2(0.0))) || any(greaterThan(coord, vec2(1.0))))
+            return 0.0; // behind the camera or out of the screen
+        float behind = -current.z - getSceneDistance(coord);
+        if(behind > 0.0 && behind < stepLength * SSR_THICKNESS){
+            for(int j = 0; j < SSR_REFINE_STEPS; j++){
+                vec3 middle = 0.5 * (previous + current);
+                if(-middle.z > getSceneDistance(getScreenCoord(middle)))
+                    current = middle;
+                else
+                    previous = middle;
+            }
+            hitCoord = getScreenCoord(current);
+            vec2 edge = smoothstep(vec2(0.0), vec2(SSR_EDGE_FADE), min(hitCoord, 1.0 - hitCoord));
+            return edge.x * edge.y * (1.0 - float(i) / float(SSR_STEPS));
+        }
+        previous = current;
+        stepLength *= SSR_STEP_GROWTH;
+    }
+    return 0.0;
+}
+
+// Same color as skybox.fs in the given direction
+vec3 getSkyColor(vec3 direction)
+{
+    vec3 color = mix(texture(skyboxNocturnal, direction), texture(skyboxDiurnal, direction), coeDiurnal).rgb;
+    return pow(color, vec3(1.0 / 2.2));
+}
+
 void main()
 {
     float invW = 1.0 / projectionPos.w;
     vec2 texCoordRefX = vec2((projectionPos.x * invW + 1.0) * 0.5, (projectionPos.y * invW + 1.0) * 0.5);
-    vec4 distortion = texture(dudvMap, texcoord) * DISTORTION_SCALE;
-    distortion.x = pow(distortion.x, 0.781);
-    distortion.y = pow(distortion.y, 0.781);
-
-    // refraction & reflection
-    vec4 dudvColor = texture(dudvMap, texcoord + time + distortion.xy);
-    dudvColor.x = pow(dudvColor.x, 0.781);
-    dudvColor.y = pow(dudvColor.y, 0.781);
-    dudvColor = dudvColor * 2.0 - 1.0;
-    dudvColor = normalize(dudvColor) * WAVE_SCALE;
-    texCoordRefX = clamp(texCoordRefX + dudvColor.xy, 0.001, 0.999);
-    vec3 refractColor = texture(refraction, texCoordRefX).rgb;
-    vec3 reflectColor = texture(reflection, texCoordRefX).rgb;
+    vec3 viewDir = normalize(viewPos - worldFragPos);
+    vec3 normal;
+    float fresnel;
+    float foam = 0.0;
+    if(ocean.enabled){
+        // FFT surface: the slopes give the normal, which distorts the refraction & reflection
+        vec3 slopes = texture(oceanSlopes, oceanCoord).xyz;
+        normal = normalize(vec3(-slopes.x, 1.0, -slopes.y));
+        texCoordRefX = clamp(texCoordRefX + normal.xz * OCEAN_DISTORTION_SCALE, 0.001, 0.999);
+        fresnel = clamp(dot(viewDir, normal), 0.0, 1.0);
+        foam = clamp((OCEAN_FOAM_JACOBIAN - slopes.z) / OCEAN_FOAM_RANGE, 0.0, 1.0);
+    }
+    else{
+        vec4 distortion = texture(dudvMap, texcoord) * DISTORTION_SCALE;
+        distortion.x = pow(distortion.x, 0.781);
+        distortion.y = pow(distortion.y, 0.781);
+
+        // refraction & reflection
+        vec4 dudvColor = texture(dudvMap, texcoord + time + distortion.xy);
+        dudvColor.x = pow(dudvColor.x, 0.781);
+        dudvColor.y = pow(dudvColor.y, 0.781);
+        dudvColor = dudvColor * 2.0 - 1.0;
+        dudvColor = normalize(dudvColor) * WAVE_SCALE;
+        texCoordRefX = clamp(texCoordRefX + dudvColor.xy, 0.001, 0.999);
+
+        normal = texture(normalMap, texcoord + time + distortion.xy).xyz;
+        normal = normalize(normal * 2.0 - 1.0);
+        normal = vec3(normal.x, normal.z, -normal.y);// transfer normal from tangent space into world space
+        fresnel = viewDir.y;// i.e. viewDir.y = dot(vec3(0.0, 1.0, 0.0), viewDir)
+    }
+    vec3 refractColor = samplePass(refraction, refractionScale, texCoordRefX);
+    vec3 reflectColor;
+    if(ssr){
+        // the reflected ray always leaves the surface, even where the normal leans a lot
+        vec3 direction = reflect(-viewDir, normal);
+        direction.y = abs(direction.y);
+        vec2 hitCoord;
+        float confidence = traceReflection(worldFragPos, direction, hitCoord);
+        reflectColor = getSkyColor(direction);
+        if(confidence > 0.0)
+            reflectColor = mix(reflectColor, texture(sceneColor, hitCoord).rgb, confidence);
+    }
+    else
+        reflectColor = samplePass(reflection, reflectionScale, texCoordRefX);
 
     // highlight
-    vec3 normal = texture(normalMap, texcoord + time + distortion.xy).xyz;
-    normal = normalize(normal * 2.0 - 1.0);
-    normal = vec3(normal.x, normal.z, -normal.y);// transfer normal from tangent space into world space
-    vec3 viewDir = normalize(viewPos - worldFragPos);
     vec3 halfDir = normalize(sun.direction + viewDir);
     float spec = pow(clamp(dot(halfDir, normal), 0.0, 1.0), 128);
-    float fresnel = viewDir.y;// i.e. viewDir.y = dot(vec3(0.0, 1.0, 0.0), viewDir)
     vec3 specular = spec * sun.lightColor;
 
     // 㴹ֱˮ棬Ǿͻûз䣬fresnel1ǿˮ棬ǾȫǷ䣬fresnel0
     vec3 color = mix((reflectColor + specular), refractColor, fresnel);
+    color = mix(color, OCEAN_FOAM_COLOR, foam * 0.7);
 
     float fogFactor = getFogFactor(fog, viewPos, worldFragPos);
     vec3 colorWithFog = mix(color, fog.Color, fogFactor);
@@ -5,15 +5,63 @@ layout (location = 1) in vec2 aTexcoord;
 out vec4 projectionPos;
 out vec2 texcoord;
 out vec3 worldFragPos;
+out vec2 oceanCoord;
+
+#pragma include ocean.glsl
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 uniform float scaleTex;
+uniform OceanGrid ocean;
+
+// Displaced point (x, z) of the water rectangle, with the waves filtered for a grid of the given spacing
+vec3 getOceanPosition(OceanGrid grid, vec2 position, float spacing){
+    position = clamp(position, -grid.halfSize, grid.halfSize);
+    float lod = max(log2(spacing * float(OCEAN_FFT_SIZE) / grid.patchSize), 0.0);
+    return vec3(position.x, grid.height, position.y) + textureLod(oceanDisplacement, position / grid.patchSize, lod).xyz;
+}
+
+// gl_VertexID gives the level and the vertex inside it, as in getClipmapVertex() of terrain_vertex.glsl.
+// Near its border a level morphs into the next one, so that no crack shows. coord is the undisplaced position in patches
+void getOceanVertex(OceanGrid grid, out vec3 position, out vec2 coord){
+    const int M = OCEAN_GRID_SIZE;
+    int level = gl_VertexID / ((M + 1) * (M + 1));
+    int local = gl_VertexID - level * (M + 1) * (M + 1);
+    ivec2 vertex = ivec2(grid.origins[level]) + ivec2(local % (M + 1), local / (M + 1));
+    float spacing = grid.spacing * float(1 << level);
+
+    position = getOceanPosition(grid, vec2(vertex) * spacing, spacing);
+    if(level + 1 < grid.levels){
+        vec2 distance = abs(vec2(vertex) - grid.center / spacing);
+        float alpha = clamp((max(distance.x, distance.y) - (M / 2 - 2 - OCEAN_GRID_MORPH)) / OCEAN_GRID_MORPH, 0.0, 1.0);
+        // the next level is linear between its vertices, along the same triangles
+        ivec2 coarse = vertex >> 1;
+        ivec2 odd = vertex & 1;
+        ivec2 a = coarse, b = coarse + odd;
+        if(odd.x == 1 && odd.y == 1){
+            a = coarse + ivec2(1, 0);
+            b = coarse + ivec2(0, 1);
+        }
+        vec3 coarsePosition = 0.5 * (getOceanPosition(grid, vec2(a) * 2.0 * spacing, 2.0 * spacing) + getOceanPosition(grid, vec2(b) * 2.0 * spacing, 2.0 * spacing));
+        position = mix(position, coarsePosition, alpha);
+    }
+    coord = clamp(vec2(vertex) * spacing, -grid.halfSize, grid.halfSize) / grid.patchSize;
+}
 
 void main()
 {
-    vec4 worldPos = model * vec4(aPos, 1.0);
+    vec4 worldPos;
+    if(ocean.enabled){
+        // FFT surface: LOD grid around the camera, built from gl_VertexID
+        vec3 position;
+        getOceanVertex(ocean, position, oceanCoord);
+        worldPos = vec4(position, 1.0);
+    }
+    else{
+        worldPos = model * vec4(aPos, 1.0);
+        oceanCoord = vec2(0.0);
+    }
     worldFragPos = worldPos.xyz;
     projectionPos = projection * view * worldPos;
     gl_Position = projectionPos;
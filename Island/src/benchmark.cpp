@@ -0,0 +1,86 @@
+#ifdef TERRAIN_BENCHMARK
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include <SOIL.h>
+
+#include "terrain.h"
+
+// Times the CPU side of the terrain loading (vertices, normals, chunks) on one thread and on the shared pool,
+// with scalar and SIMD normals, then ray casts, for the bundled heightmap and a synthetic 8192 x 8192 one.
+// The 8192 x 8192 terrain needs about 5 GB of memory, pass a smaller size as first argument if needed.
+
+static void benchmark(const char* name, const int& cols, const int& rows, unsigned char* heightMap) {
+    ThreadPool single(1);
+    ThreadPool& shared = ThreadPool::shared();
+    struct Config { ThreadPool* pool; bool simd; } configs[] = {
+        { &single, false }, { &single, true }, { &shared, false }, { &shared, true }
+    };
+
+    std::cout << name << " (" << cols << "x" << rows << ")" << std::endl;
+    GLdouble reference = 0.0;
+    for (const Config& config : configs) {
+        Terrain terrain;
+        terrain.setThreadPool(*config.pool);
+        terrain.setSimdNormals(config.simd);
+        terrain.generate(glm::vec2(750.f), 37.5f, 300.f, cols, rows, heightMap);
+
+        const TerrainLoadTimes& times = terrain.getLoadTimes();
+        if (reference == 0.0)
+            reference = times.total();
+        std::cout << "    " << config.pool->size() << " threads, " << (config.simd ? "SIMD  " : "scalar") << " normals: "
+            << times.total() << " ms (vertices " << times.Vertices << ", face normals " << times.FaceNormals
+            << ", vertex normals " << times.VertexNormals << ", chunks " << times.Chunks << ", pack " << times.Pack << "), speedup x"
+            << reference / times.total() << std::endl;
+    }
+
+    // ray casts from above the terrain, going down at various angles
+    Terrain terrain;
+    terrain.generate(glm::vec2(750.f), 37.5f, 300.f, cols, rows, heightMap);
+    const int rayCount = 10000;
+    std::vector<glm::vec3> origins(rayCount), directions(rayCount);
+    for (int i = 0; i < rayCount; i++) {
+        origins[i] = glm::vec3(sinf(i * 0.37f) * 370.f, 40.f, cosf(i * 0.61f) * 370.f);
+        directions[i] = glm::vec3(sinf(i * 1.3f), -0.05f - 0.5f * (i % 7) / 7.f, cosf(i * 1.7f));
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int hits = 0;
+    for (int i = 0; i < rayCount; i++) {
+        glm::vec3 hit;
+        hits += terrain.raycast(origins[i], directions[i], 2000.f, hit);
+    }
+    std::cout << "    " << rayCount << " ray casts: " << std::chrono::duration<GLdouble, std::milli>(std::chrono::steady_clock::now() - start).count()
+        << " ms, " << hits << " hits" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int cols, rows;
+    unsigned char* heightMap = SOIL_load_image("resources/textures/heightmap_island_low_poly.jpg", &cols, &rows, 0, SOIL_LOAD_L);
+    if (heightMap) {
+        benchmark("heightmap_island_low_poly.jpg", cols, rows, heightMap);
+        SOIL_free_image_data(heightMap);
+    }
+    else
+        std::cout << "ERROR::BENCHMARK: Failed to load the bundled heightmap" << std::endl;
+
+    // a few octaves of waves, enough to get non trivial normals everywhere
+    int size = argc > 1 ? atoi(argv[1]) : 8192;
+    std::vector<unsigned char> synthetic(size * size);
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            float height = 0.f, amplitude = 0.5f, frequency = 4.f / size;
+            for (int octave = 0; octave < 4; octave++) {
+                height += amplitude * sinf(i * frequency) * cosf(j * frequency * 1.3f);
+                amplitude *= 0.5f;
+                frequency *= 2.1f;
+            }
+            synthetic[i * size + j] = (unsigned char)(127.5f + 127.f * height);
+        }
+    }
+    benchmark("synthetic", size, size, &synthetic[0]);
+    return 0;
+}
+
+#endif
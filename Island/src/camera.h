@@ -2,6 +2,7 @@
 #define CAMERA_H
 
 #include <vector>
+#include <iostream>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -22,6 +23,9 @@ const float PITCH = 0.0f;
 const float SPEED = 30.f;
 const float SENSITIVITY = 0.03f;
 const float ZOOM = 45.0f;
+// Offsets of the clip planes of the water passes above the water, must match terrain.vs
+const float WATER_REFRACTION_CLIP = 4.f;
+const float WATER_REFLECTION_CLIP = -0.6f;
 
 struct Plane {
 	glm::vec3 Normal;
@@ -32,11 +36,66 @@ struct Plane {
 		D = glm::dot(-Normal, Point);
 	}
 
-	GLfloat Distance(glm::vec3 point) {
+	GLfloat Distance(glm::vec3 point) const {
 		return glm::dot(Normal, point) + D;
 	}
 };
 
+// Most planes of a FrustumPlanes, room for the 7 planes of the water passes
+const GLuint FRUSTUM_PLANES_MAX = 8;
+
+// Planes of a frustum as separate arrays of the normal components and of the distances (structure of arrays),
+// so that a SIMD culler tests 4 or 8 objects against a plane from 4 broadcasts
+struct FrustumPlanes {
+	GLfloat NormalX[FRUSTUM_PLANES_MAX], NormalY[FRUSTUM_PLANES_MAX], NormalZ[FRUSTUM_PLANES_MAX], D[FRUSTUM_PLANES_MAX];
+	GLuint Count = 0;
+
+	FrustumPlanes() { }
+	FrustumPlanes(const Plane* planes, const GLuint& planeCount) {
+		for (GLuint i = 0; i < planeCount; ++i)
+			Add(planes[i]);
+	}
+
+	// The planes past FRUSTUM_PLANES_MAX are left out, which only culls less
+	void Add(const Plane& plane) {
+		if (Count == FRUSTUM_PLANES_MAX) {
+			std::cout << "ERROR::FRUSTUM_PLANES: More than " << FRUSTUM_PLANES_MAX << " planes" << std::endl;
+			return;
+		}
+		NormalX[Count] = plane.Normal.x;
+		NormalY[Count] = plane.Normal.y;
+		NormalZ[Count] = plane.Normal.z;
+		D[Count] = plane.D;
+		Count++;
+	}
+};
+
+// Gribb-Hartmann extraction of the 6 planes of the clip volume of any view projection matrix (perspective, orthographic,
+// mirrored), in world space, normalized and pointing inside, in the order of Camera::Frustum: near, far, top, bottom, left, right.
+// A point is inside when -w <= x, y, z <= w in clip space, i.e. when (row 3 +- row i) . p >= 0
+inline void ExtractFrustumPlanes(const glm::mat4& viewProjection, Plane planes[6])
+{
+	glm::vec4 rows[4];
+	for (GLuint i = 0; i < 4; ++i)
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	glm::vec4 equations[6] = { rows[3] + rows[2], rows[3] - rows[2], rows[3] - rows[1], rows[3] + rows[1], rows[3] + rows[0], rows[3] - rows[0] };
+	for (GLuint i = 0; i < 6; ++i) {
+		GLfloat length = glm::length(glm::vec3(equations[i]));
+		planes[i].Normal = glm::vec3(equations[i]) / length;
+		planes[i].D = equations[i].w / length;
+		planes[i].Point = -planes[i].Normal * planes[i].D;
+	}
+}
+
+inline void ExtractFrustumPlanes(const glm::mat4& viewProjection, FrustumPlanes& planes)
+{
+	Plane extracted[6];
+	ExtractFrustumPlanes(viewProjection, extracted);
+	planes.Count = 0;
+	for (GLuint i = 0; i < 6; ++i)
+		planes.Add(extracted[i]);
+}
+
 // An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
 class Camera
 {
@@ -59,6 +118,9 @@ public:
 	GLfloat Near, Far;
 	GLfloat NearWidth, NearHeight; // Width and height of near plane
 	GLfloat FarWidth, FarHeight; // Width and height of far plane
+	// Frustums of the water passes, the 6 planes of Frustum (mirrored for the reflection) followed by the water plane
+	Plane RefractionFrustum[7];
+	Plane ReflectionFrustum[7];
 
 	// Constructor with vectors
 	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(-0.826095f, -0.00348972f, -0.563521f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
@@ -166,52 +228,42 @@ public:
 			Zoom = 45.0f;
 	}
 
-	// (Re)calculates the view frustum planes of the camera's current position/orientation.
-	// For a more in-depth description of the algorithm see http://www.lighthouse3d.com/tutorials/view-frustum-culling/geometric-approach-extracting-the-planes/
+	// (Re)calculates the view frustum planes of the camera's current position/orientation, from its view projection matrix
 	void CalculateViewFrustum()
 	{
-		// 1. First calculate all 8 points of the frustum (corners)
-		// - Naming convention: (n=near,f=far)(t=top,b=bottom)(l=left,r=right)
-		// - - Near
-		glm::vec3 nc = this->Position + this->Front * this->Near; // nc = near-center
-
-		glm::vec3 ntl = nc + (this->Up * this->NearHeight / 2.0f) - (this->Right * this->NearWidth / 2.0f);
-		glm::vec3 ntr = nc + (this->Up * this->NearHeight / 2.0f) + (this->Right * this->NearWidth / 2.0f);
-		glm::vec3 nbl = nc - (this->Up * this->NearHeight / 2.0f) - (this->Right * this->NearWidth / 2.0f);
-		glm::vec3 nbr = nc - (this->Up * this->NearHeight / 2.0f) + (this->Right * this->NearWidth / 2.0f);
-		// - - Far
-		glm::vec3 fc = this->Position + this->Front * this->Far; // fc = far-center
-
-		glm::vec3 ftl = fc + (this->Up * this->FarHeight / 2.0f) - (this->Right * this->FarWidth / 2.0f);
-		glm::vec3 ftr = fc + (this->Up * this->FarHeight / 2.0f) + (this->Right * this->FarWidth / 2.0f);
-		glm::vec3 fbl = fc - (this->Up * this->FarHeight / 2.0f) - (this->Right * this->FarWidth / 2.0f);
-		glm::vec3 fbr = fc - (this->Up * this->FarHeight / 2.0f) + (this->Right * this->FarWidth / 2.0f);
-
-		// 2. Create planes out of plane normals and positions (note: all normals point inside frustum)
-		// ȫ
-		// - 2.1 - Near/Far plane (trick: use front vector as normal and nc/fc as points on pane)
-		this->Frustum[0].Normal = this->Front;
-		this->Frustum[0].Point = nc;
-		this->Frustum[1].Normal = -this->Front;
-		this->Frustum[1].Point = fc;
-		// - 2.2 - Top/Bottom planes (cross vector with up and vector between top/bottom side of near/far plane and position
-		glm::vec3 difference = (nc + this->Up * this->NearHeight / 2.0f) - this->Position;
-		this->Frustum[2].Normal = glm::cross(glm::normalize(difference), this->Right);
-		this->Frustum[2].Point = this->Position; // Position is on the plane due to perspective projection's pyramid form
-		difference = (nc - this->Up * this->NearHeight / 2.0f) - this->Position;
-		this->Frustum[3].Normal = glm::cross(this->Right, glm::normalize(difference));
-		this->Frustum[3].Point = this->Position;
-		// - 2.3 - Left/Right planes (cross vector with up and vector between left/right side of near/far plane and position
-		difference = (nc - this->Right * this->NearWidth / 2.0f) - this->Position;
-		this->Frustum[4].Normal = glm::cross(glm::normalize(difference), this->Up);
-		this->Frustum[4].Point = this->Position;
-		difference = (nc + this->Right * this->NearWidth / 2.0f) - this->Position;
-		this->Frustum[5].Normal = glm::cross(this->Up, glm::normalize(difference));
-		this->Frustum[5].Point = this->Position;
-
-		// 3. Calculate D (distance) value of plane equation for each of the frustum planes
+		ExtractFrustumPlanes(this->Projection * GetViewMatrix(), this->Frustum);
+	}
+
+	// The 8 corners of the part of the view frustum between the distances nearDistance and farDistance along Front,
+	// near ones first, in the order top left, top right, bottom left, bottom right
+	void GetFrustumCorners(const GLfloat& nearDistance, const GLfloat& farDistance, glm::vec3 corners[8])
+	{
+		GLfloat distances[2] = { nearDistance, farDistance };
+		for (GLuint i = 0; i < 2; ++i) {
+			glm::vec3 center = this->Position + this->Front * distances[i];
+			glm::vec3 up = this->Up * (this->NearHeight / this->Near * distances[i] / 2.0f);
+			glm::vec3 right = this->Right * (this->NearWidth / this->Near * distances[i] / 2.0f);
+			corners[4 * i + 0] = center + up - right;
+			corners[4 * i + 1] = center + up + right;
+			corners[4 * i + 2] = center - up - right;
+			corners[4 * i + 3] = center - up + right;
+		}
+	}
+
+	// (Re)calculates RefractionFrustum and ReflectionFrustum, so call it after CalculateViewFrustum().
+	// The refraction keeps what is under the water, the reflection what is over it, as seen from the imaginary camera
+	void CalculateWaterFrustums(const float& waterHeight)
+	{
 		for (GLuint i = 0; i < 6; ++i)
-			this->Frustum[i].CalcDistance();
+			this->RefractionFrustum[i] = this->Frustum[i];
+		ExtractFrustumPlanes(this->Projection * GetImaginaryViewMatrix(waterHeight), this->ReflectionFrustum);
+		// water planes at the clip planes of the passes, so that what is culled would have been clipped anyway
+		this->RefractionFrustum[6].Normal = glm::vec3(0.f, -1.f, 0.f);
+		this->RefractionFrustum[6].Point = glm::vec3(0.f, waterHeight + WATER_REFRACTION_CLIP, 0.f);
+		this->ReflectionFrustum[6].Normal = glm::vec3(0.f, 1.f, 0.f);
+		this->ReflectionFrustum[6].Point = glm::vec3(0.f, waterHeight + WATER_REFLECTION_CLIP, 0.f);
+		this->RefractionFrustum[6].CalcDistance();
+		this->ReflectionFrustum[6].CalcDistance();
 	}
 
 private:
@@ -0,0 +1,72 @@
+#ifdef CULLING_BENCHMARK
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "frustum_culler.h"
+
+// Times the culling of random spheres against the view frustum: one instance matrix at a time as Model::isInFrustum
+// does, then FrustumCuller into a bitmask and into an index list. Reports milliseconds per million spheres.
+// The sphere count is the first argument, 1 million by default.
+
+template<typename Cull>
+static GLdouble timePerMillion(const GLuint& sphereCount, Cull cull) {
+    const int runs = 20;
+    cull(); // warm up
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++)
+        cull();
+    GLdouble ms = std::chrono::duration<GLdouble, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+    return ms * 1e6 / sphereCount;
+}
+
+int main(int argc, char* argv[]) {
+    GLuint sphereCount = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    Camera camera(glm::vec3(0.f, 10.f, 0.f));
+    camera.SetProjectionMatrix(1280.f, 720.f, 0.1f, 750.f);
+    camera.CalculateViewFrustum();
+
+    // trees scattered over the island, the model sphere is 4 units above the origin of the model
+    const glm::vec3 center(0.f, 4.f, 0.f);
+    const GLfloat radius = 5.f;
+    std::vector<glm::mat4> models(sphereCount);
+    FrustumCuller culler;
+    srand(1);
+    for (GLuint i = 0; i < sphereCount; i++) {
+        glm::mat4 model = glm::translate(glm::mat4(1.f), glm::vec3(rand() % 1500 - 750.f, 0.f, rand() % 1500 - 750.f));
+        models[i] = glm::scale(model, glm::vec3(1.5f + (rand() % 10) / 10.f));
+        culler.add(glm::vec3(models[i] * glm::vec4(center, 1.f)), radius * glm::length(glm::vec3(models[i][0])));
+    }
+
+    GLuint visibleCount = 0;
+    GLdouble reference = timePerMillion(sphereCount, [&]() {
+        visibleCount = 0;
+        for (GLuint i = 0; i < sphereCount; i++) {
+            glm::vec3 worldCenter = glm::vec3(models[i] * glm::vec4(center, 1.f));
+            GLfloat worldRadius = radius * models[i][0][0];
+            GLuint plane = 0;
+            while (plane < 6 && camera.Frustum[plane].Distance(worldCenter) >= -worldRadius)
+                plane++;
+            visibleCount += plane == 6;
+        }
+    });
+    std::cout << sphereCount << " spheres, " << visibleCount << " visible" << std::endl;
+    std::cout << "    per instance matrix: " << reference << " ms per million" << std::endl;
+
+    std::vector<GLuint> mask;
+    GLdouble maskTime = timePerMillion(sphereCount, [&]() { culler.cullMask(camera.Frustum, 6, mask); });
+    std::cout << "    FrustumCuller mask:  " << maskTime << " ms per million, speedup x" << reference / maskTime << std::endl;
+
+    std::vector<GLuint> indices;
+    GLdouble indexTime = timePerMillion(sphereCount, [&]() { culler.cullIndices(camera.Frustum, 6, indices); });
+    std::cout << "    FrustumCuller index: " << indexTime << " ms per million, speedup x" << reference / indexTime
+        << ", " << indices.size() << " visible" << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <limits>
+
+#include "frustum_culler.h"
+
+#if defined(__AVX__)
+#define FRUSTUM_CULLER_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLER_SSE
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// spheres per iteration, the arrays are padded to a multiple of it
+#ifdef FRUSTUM_CULLER_AVX
+const GLuint FRUSTUM_CULLER_WIDTH = 8;
+#elif defined(FRUSTUM_CULLER_SSE)
+const GLuint FRUSTUM_CULLER_WIDTH = 4;
+#else
+const GLuint FRUSTUM_CULLER_WIDTH = 1;
+#endif
+
+// index of the lowest set bit of bits, which is not 0
+static inline GLuint lowestBit(const GLuint& bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+void FrustumCuller::add(const glm::vec3& center, const GLfloat& radius) {
+    if (m_count == m_x.size()) {
+        // padding: a negative infinite radius is outside of any plane
+        GLuint padded = m_count + FRUSTUM_CULLER_WIDTH;
+        m_x.resize(padded, 0.f);
+        m_y.resize(padded, 0.f);
+        m_z.resize(padded, 0.f);
+        m_radius.resize(padded, -std::numeric_limits<GLfloat>::infinity());
+    }
+    set(m_count++, center, radius);
+}
+
+void FrustumCuller::set(const GLuint& index, const glm::vec3& center, const GLfloat& radius) {
+    m_x[index] = center.x;
+    m_y[index] = center.y;
+    m_z[index] = center.z;
+    m_radius[index] = radius;
+}
+
+void FrustumCuller::clear() {
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+    m_radius.clear();
+    m_count = 0;
+}
+
+void FrustumCuller::cullMask(const Plane* planes, const GLuint& planeCount, std::vector<GLuint>& mask) const {
+    if (planeCount > FRUSTUM_PLANES_MAX) {
+        std::cout << "ERROR::FRUSTUM_CULLER: More than " << FRUSTUM_PLANES_MAX << " planes" << std::endl;
+        mask.assign((m_count + 31) / 32, 0);
+        return;
+    }
+    cullMask(FrustumPlanes(planes, planeCount), mask);
+}
+
+void FrustumCuller::cullIndices(const Plane* planes, const GLuint& planeCount, std::vector<GLuint>& indices) const {
+    cullMask(planes, planeCount, m_mask);
+    listIndices(indices);
+}
+
+void FrustumCuller::cullMask(const FrustumPlanes& planes, std::vector<GLuint>& mask) const {
+    mask.assign((m_count + 31) / 32, 0);
+    const GLuint planeCount = planes.Count;
+    GLuint padded = (GLuint)m_x.size();
+
+#ifdef FRUSTUM_CULLER_AVX
+    __m256 normalX[FRUSTUM_PLANES_MAX], normalY[FRUSTUM_PLANES_MAX], normalZ[FRUSTUM_PLANES_MAX], distance[FRUSTUM_PLANES_MAX];
+    for (GLuint p = 0; p < planeCount; p++) {
+        normalX[p] = _mm256_set1_ps(planes.NormalX[p]);
+        normalY[p] = _mm256_set1_ps(planes.NormalY[p]);
+        normalZ[p] = _mm256_set1_ps(planes.NormalZ[p]);
+        distance[p] = _mm256_set1_ps(planes.D[p]);
+    }
+    const __m256 signBit = _mm256_set1_ps(-0.f);
+    for (GLuint i = 0; i < padded; i += 8) {
+        __m256 x = _mm256_loadu_ps(&m_x[i]), y = _mm256_loadu_ps(&m_y[i]), z = _mm256_loadu_ps(&m_z[i]);
+        __m256 minusRadius = _mm256_xor_ps(_mm256_loadu_ps(&m_radius[i]), signBit);
+        __m256 inside = _mm256_cmp_ps(minusRadius, minusRadius, _CMP_EQ_OQ);
+        for (GLuint p = 0; p < planeCount; p++) {
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(normalX[p], x), _mm256_mul_ps(normalY[p], y)),
+                _mm256_add_ps(_mm256_mul_ps(normalZ[p], z), distance[p]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, minusRadius, _CMP_GE_OQ));
+        }
+        mask[i / 32] |= (GLuint)_mm256_movemask_ps(inside) << (i % 32);
+    }
+#elif defined(FRUSTUM_CULLER_SSE)
+    __m128 normalX[FRUSTUM_PLANES_MAX], normalY[FRUSTUM_PLANES_MAX], normalZ[FRUSTUM_PLANES_MAX], distance[FRUSTUM_PLANES_MAX];
+    for (GLuint p = 0; p < planeCount; p++) {
+        normalX[p] = _mm_set1_ps(planes.NormalX[p]);
+        normalY[p] = _mm_set1_ps(planes.NormalY[p]);
+        normalZ[p] = _mm_set1_ps(planes.NormalZ[p]);
+        distance[p] = _mm_set1_ps(planes.D[p]);
+    }
+    const __m128 signBit = _mm_set1_ps(-0.f);
+    for (GLuint i = 0; i < padded; i += 4) {
+        __m128 x = _mm_loadu_ps(&m_x[i]), y = _mm_loadu_ps(&m_y[i]), z = _mm_loadu_ps(&m_z[i]);
+        __m128 minusRadius = _mm_xor_ps(_mm_loadu_ps(&m_radius[i]), signBit);
+        __m128 inside = _mm_cmpeq_ps(minusRadius, minusRadius);
+        for (GLuint p = 0; p < planeCount; p++) {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX[p], x), _mm_mul_ps(normalY[p], y)),
+                _mm_add_ps(_mm_mul_ps(normalZ[p], z), distance[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, minusRadius));
+        }
+        mask[i / 32] |= (GLuint)_mm_movemask_ps(inside) << (i % 32);
+    }
+#else
+    for (GLuint i = 0; i < padded; i++) {
+        bool inside = true;
+        for (GLuint p = 0; p < planeCount && inside; p++)
+            inside = planes.NormalX[p] * m_x[i] + planes.NormalY[p] * m_y[i] + planes.NormalZ[p] * m_z[i] + planes.D[p] >= -m_radius[i];
+        if (inside)
+            mask[i / 32] |= 1u << (i % 32);
+    }
+#endif
+}
+
+void FrustumCuller::cullIndices(const FrustumPlanes& planes, std::vector<GLuint>& indices) const {
+    cullMask(planes, m_mask);
+    listIndices(indices);
+}
+
+void FrustumCuller::listIndices(std::vector<GLuint>& indices) const {
+    indices.clear();
+    for (GLuint word = 0; word < m_mask.size(); word++) {
+        for (GLuint bits = m_mask[word]; bits != 0; bits &= bits - 1)
+            indices.push_back(word * 32 + lowestBit(bits));
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "camera.h"
+
+/* Bounding spheres in world space, kept as separate arrays of x, y, z and radius (structure of arrays), tested
+against the planes of a frustum 8 (AVX) or 4 (SSE) at a time. The arrays are padded with spheres that are never
+visible, so that the SIMD loop has no remainder. For the static objects: add their spheres once, cull every pass. */
+class FrustumCuller {
+public:
+    void add(const glm::vec3& center, const GLfloat& radius);
+    void set(const GLuint& index, const glm::vec3& center, const GLfloat& radius);
+    void clear();
+    GLuint size() const { return m_count; }
+    // Visibility of every sphere touching the inside of all the planes (normals inside): bit i % 32 of mask[i / 32]
+    void cullMask(const FrustumPlanes& planes, std::vector<GLuint>& mask) const;
+    // Indices of the visible spheres, in increasing order
+    void cullIndices(const FrustumPlanes& planes, std::vector<GLuint>& indices) const;
+    // Same as above with an array of planes, e.g. Camera::Frustum, up to FRUSTUM_PLANES_MAX
+    void cullMask(const Plane* planes, const GLuint& planeCount, std::vector<GLuint>& mask) const;
+    void cullIndices(const Plane* planes, const GLuint& planeCount, std::vector<GLuint>& indices) const;
+private:
+    std::vector<GLfloat> m_x, m_y, m_z, m_radius;
+    GLuint m_count = 0;
+    mutable std::vector<GLuint> m_mask; // scratch of cullIndices()
+
+    // indices of the bits set in m_mask
+    void listIndices(std::vector<GLuint>& indices) const;
+};
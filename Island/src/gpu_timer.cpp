@@ -0,0 +1,70 @@
+#include <iomanip>
+#include <sstream>
+
+#include "gpu_timer.h"
+
+GpuTimer::~GpuTimer() {
+    for (GLuint frame = 0; frame < GPU_TIMER_LATENCY; frame++) {
+        for (const Query& query : m_queries[frame])
+            glDeleteQueries(1, &query.ID);
+    }
+}
+
+void GpuTimer::begin(const std::string& name) {
+    GLuint section = 0;
+    while (section < m_sections.size() && m_sections[section].Name != name)
+        section++;
+    if (section == m_sections.size()) {
+        m_sections.push_back(Section());
+        m_sections.back().Name = name;
+    }
+
+    std::vector<Query>& queries = m_queries[m_frame];
+    GLuint& used = m_used[m_frame];
+    if (used == queries.size()) {
+        queries.push_back(Query());
+        glGenQueries(1, &queries.back().ID);
+    }
+    queries[used].Section = section;
+    glBeginQuery(GL_TIME_ELAPSED, queries[used].ID);
+    used++;
+}
+
+void GpuTimer::end() {
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void GpuTimer::endFrame() {
+    // the next slot holds the oldest frame, GPU_TIMER_LATENCY - 1 frames back
+    m_frame = (m_frame + 1) % GPU_TIMER_LATENCY;
+    std::vector<Query>& queries = m_queries[m_frame];
+    // the first frame also times the lazy work of the driver (shader compilation, allocations), it is ignored
+    bool firstFrame = m_frameCount < GPU_TIMER_LATENCY;
+    if (firstFrame)
+        m_frameCount++;
+    for (GLuint i = 0; i < (firstFrame ? 0 : m_used[m_frame]); i++) {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(queries[i].ID, GL_QUERY_RESULT, &elapsed);
+        Section& section = m_sections[queries[i].Section];
+        section.Total += elapsed * 1e-6;
+        section.Frames++;
+    }
+    m_used[m_frame] = 0;
+}
+
+std::string GpuTimer::report() {
+    std::ostringstream stream;
+    stream << std::fixed << std::setprecision(2);
+    GLdouble total = 0.0;
+    for (Section& section : m_sections) {
+        if (section.Frames == 0)
+            continue;
+        GLdouble average = section.Total / section.Frames;
+        total += average;
+        stream << section.Name << " " << average << " ms, ";
+        section.Total = 0.0;
+        section.Frames = 0;
+    }
+    stream << "total " << total << " ms";
+    return stream.str();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Frames a query is kept before its result is read, so that reading it never waits for the GPU
+const GLuint GPU_TIMER_LATENCY = 3;
+
+/* GPU time of the passes of a frame, measured with GL_TIME_ELAPSED queries.
+Sections are named, cannot be nested, and may be skipped on some frames (e.g. GOD RAYS). */
+class GpuTimer {
+public:
+    GpuTimer() = default;
+    ~GpuTimer();
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+    void begin(const std::string& name);
+    void end();
+    // To be called once per frame after the last section, collects the results of an older frame
+    void endFrame();
+    // Average milliseconds of every section since the last report, e.g. "shadow 1.20 ms, refraction 0.85 ms"
+    std::string report();
+private:
+    struct Section {
+        std::string Name;
+        GLdouble Total = 0.0; // ms
+        GLuint Frames = 0;
+    };
+    struct Query {
+        GLuint ID;
+        GLuint Section;
+    };
+    std::vector<Section> m_sections; // in the order they were first begun
+    std::vector<Query> m_queries[GPU_TIMER_LATENCY]; // queries of the last frames, reused
+    GLuint m_used[GPU_TIMER_LATENCY] = {};
+    GLuint m_frame = 0;
+    GLuint m_frameCount = 0; // up to GPU_TIMER_LATENCY
+};
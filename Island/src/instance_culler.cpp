@@ -0,0 +1,118 @@
+#include <iostream>
+
+#include "instance_culler.h"
+#include "resource_manager.h"
+
+// must match the size of planes in cull_instances.vs
+const GLuint INSTANCE_CULLING_PLANES_MAX = 8;
+
+InstanceCuller::InstanceCuller(const std::vector<glm::mat4>& instances, const glm::vec3& center, const GLfloat& radius, const GLuint& listCount,
+    const InstanceCullingMode& mode)
+    : m_mode(mode), m_instances(instances), m_center(center), m_radius(radius),
+    m_queries(2 * listCount), m_pending(2 * listCount, false), m_latest(listCount, 0), m_counts(listCount, 0) {
+    glGenBuffers(1, &m_output);
+    glBindBuffer(GL_ARRAY_BUFFER, m_output);
+    glBufferData(GL_ARRAY_BUFFER, listCount * m_instances.size() * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+
+    m_shader = ResourceManager::loadShader("shaders/cull_instances.vs", "shaders/simple.fs", "shaders/cull_instances.gs", "cullInstances");
+    const GLchar* varyings[] = { "instanceModel" };
+    m_shader.setFeedbackVaryings(varyings, 1);
+
+    // one point per instance, its matrix in locations 0 to 3
+    glGenVertexArrays(1, &m_VAO);
+    glGenBuffers(1, &m_VBO);
+    glBindVertexArray(m_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+    glBufferData(GL_ARRAY_BUFFER, m_instances.size() * sizeof(glm::mat4), m_instances.empty() ? NULL : &m_instances[0], GL_STATIC_DRAW);
+    for (GLuint column = 0; column < 4; column++) {
+        glEnableVertexAttribArray(column);
+        glVertexAttribPointer(column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(column * sizeof(glm::vec4)));
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glGenQueries(m_queries.size(), &m_queries[0]);
+
+    for (const glm::mat4& instance : m_instances)
+        m_spheres.add(glm::vec3(instance * glm::vec4(m_center, 1.f)), m_radius * glm::length(glm::vec3(instance[0])));
+}
+
+InstanceCuller::~InstanceCuller() {
+    glDeleteQueries(m_queries.size(), &m_queries[0]);
+    glDeleteVertexArrays(1, &m_VAO);
+    glDeleteBuffers(1, &m_VBO);
+    glDeleteBuffers(1, &m_output);
+}
+
+void InstanceCuller::cull(const GLuint& list, const Plane* planes, const GLuint& planeCount) {
+    if (planeCount > INSTANCE_CULLING_PLANES_MAX) {
+        std::cout << "ERROR::INSTANCE_CULLER: More than " << INSTANCE_CULLING_PLANES_MAX << " planes" << std::endl;
+        return;
+    }
+    GLsizeiptr listSize = m_instances.size() * sizeof(glm::mat4);
+
+    if (m_mode == INSTANCE_CULLING_CPU) {
+        m_spheres.cullIndices(planes, planeCount, m_indices);
+        m_visible.clear();
+        for (GLuint index : m_indices)
+            m_visible.push_back(m_instances[index]);
+        if (!m_visible.empty()) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_output);
+            glBufferSubData(GL_ARRAY_BUFFER, list * listSize, m_visible.size() * sizeof(glm::mat4), &m_visible[0]);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        m_counts[list] = m_visible.size();
+        m_pending[2 * list] = m_pending[2 * list + 1] = false;
+        return;
+    }
+
+    if (m_instances.empty()) {
+        m_counts[list] = 0;
+        return;
+    }
+    // queries in turns: the result of the cull before the last one, if still unread, is out of date
+    m_latest[list] = 1 - m_latest[list];
+    GLuint query = 2 * list + m_latest[list];
+    // the program is shared by all the cullers
+    m_shader.use();
+    m_shader.setVector3f("center", m_center);
+    m_shader.setFloat("radius", m_radius);
+    for (GLuint i = 0; i < planeCount; i++) {
+        std::string name = "planes[" + std::to_string(i) + "]";
+        m_shader.setVector4f(name.c_str(), glm::vec4(planes[i].Normal, planes[i].D));
+    }
+    m_shader.setInteger("planeCount", planeCount);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(m_VAO);
+    glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_output, list * listSize, listSize);
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, m_queries[query]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, m_instances.size());
+    glEndTransformFeedback();
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    m_pending[query] = true;
+}
+
+GLuint InstanceCuller::getCount(const GLuint& list) {
+    GLuint latest = 2 * list + m_latest[list], previous = 2 * list + 1 - m_latest[list];
+    if (readQuery(list, latest))
+        m_pending[previous] = false;
+    else
+        readQuery(list, previous);
+    return m_counts[list];
+}
+
+bool InstanceCuller::readQuery(const GLuint& list, const GLuint& query) {
+    if (!m_pending[query])
+        return false;
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(m_queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return false;
+    glGetQueryObjectuiv(m_queries[query], GL_QUERY_RESULT, &m_counts[list]);
+    m_pending[query] = false;
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "camera.h"
+#include "shader.h"
+#include "frustum_culler.h"
+
+enum InstanceCullingMode {
+    // the instances are culled by a transform feedback pass, see cull_instances.vs/gs
+    INSTANCE_CULLING_GPU,
+    // the instances are culled on the CPU, see FrustumCuller, and the visible ones uploaded
+    INSTANCE_CULLING_CPU
+};
+
+/* Frustum culling of the instances of a model, into lists of the visible instance matrices, packed, for instanced draws.
+Each list is culled against its own planes (one list per pass) and holds up to getInstanceCount() matrices, list l
+starting at l * getInstanceCount() in getBuffer().
+On the GPU, the instances are uploaded once: a transform feedback pass tests one point per instance and its geometry
+shader only emits the visible ones, counted by a GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN query. GL 3.3 has no
+indirect draw, so the count is read back, without waiting for the GPU: cull early in the frame, so that the result
+is ready when the list is drawn. Otherwise getCount() gives the count of a previous cull of the list, whose matrices
+past the new count are still in the buffer: a few culled instances are drawn, or a few new ones are missing, for a frame. */
+class InstanceCuller {
+public:
+    // center, radius: bounding sphere of the model, scaled by each instance
+    InstanceCuller(const std::vector<glm::mat4>& instances, const glm::vec3& center, const GLfloat& radius, const GLuint& listCount,
+        const InstanceCullingMode& mode = INSTANCE_CULLING_GPU);
+    ~InstanceCuller();
+    InstanceCuller(const InstanceCuller&) = delete;
+    InstanceCuller& operator=(const InstanceCuller&) = delete;
+    // Fills list with the instances inside planes (normals inside), up to 8 planes
+    void cull(const GLuint& list, const Plane* planes, const GLuint& planeCount);
+    // Visible instances of the last cull() of list whose result the GPU has given, never blocks
+    GLuint getCount(const GLuint& list);
+    GLuint getBuffer() { return m_output; }
+    GLuint getInstanceCount() { return m_instances.size(); }
+    void setMode(const InstanceCullingMode& mode) { m_mode = mode; }
+    InstanceCullingMode getMode() { return m_mode; }
+private:
+    InstanceCullingMode m_mode;
+    std::vector<glm::mat4> m_instances;
+    glm::vec3 m_center;
+    GLfloat m_radius;
+    GLuint m_output = 0;
+    // GPU: all the instances and the points the culling pass draws from them
+    Shader m_shader;
+    GLuint m_VAO = 0, m_VBO = 0;
+    // 2 queries per list, used in turns, so that the result of a cull can be polled until the next one is done
+    std::vector<GLuint> m_queries;
+    std::vector<bool> m_pending; // query not read yet
+    std::vector<GLuint> m_latest; // query of the last cull of each list, 0 or 1
+    std::vector<GLuint> m_counts;
+
+    // reads query of list into its count if the GPU has the result
+    bool readQuery(const GLuint& list, const GLuint& query);
+    // CPU: world space bounding spheres of the instances, visible instances and upload scratch
+    FrustumCuller m_spheres;
+    std::vector<GLuint> m_indices;
+    std::vector<glm::mat4> m_visible;
+};
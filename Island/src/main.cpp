@@ -19,6 +19,10 @@
 #include "fog.h"
 #include "framebuffer.h"
 #include "geometry.h"
+#include "gpu_timer.h"
+#include "shadow_map.h"
+#include "instance_culler.h"
+#include "frustum_culler.h"
 
 Camera camera(glm::vec3(0.0f, 10.0f, 0.0f));
 
@@ -65,8 +69,11 @@ void processInput(GLFWwindow* window);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void drawDebugPlane(GLuint textureID);
+void bindTreeInstances(Model& tree, GLuint VBO, GLuint first);
 
 bool cursorFlag{ false };
+// resolution of the shadow cascades, picked with the keys 1 to 4
+GLuint shadowResolution = 2048;
 
 int main() {
     glfwInit();
@@ -128,6 +135,7 @@ int main() {
     // Load Shaders
     Shader shaderSkybox = ResourceManager::loadShader("shaders/skybox.vs", "shaders/skybox.fs", nullptr, "shaderSkybox");
     Shader shaderTerrain = ResourceManager::loadShader("shaders/terrain.vs", "shaders/terrain.fs", nullptr, "shaderTerrain");
+    Shader shaderTerrainDepth = ResourceManager::loadShader("shaders/terrain_depth.vs", "shaders/simple.fs", nullptr, "shaderTerrainDepth");
     Shader shaderHouse = ResourceManager::loadShader("shaders/house.vs", "shaders/house.fs", nullptr, "shaderHouse");
     Shader SimpleShader = ResourceManager::loadShader("shaders/simple.vs", "shaders/simple.fs", nullptr, "SimpleShader");
     Shader treeShader = ResourceManager::loadShader("shaders/tree.vs", "shaders/tree.fs", nullptr, "treeShader");
@@ -148,7 +156,7 @@ int main() {
 	shaderHouse.setInteger("material.texture_diffuse1", 0, true);
 	shaderHouse.setInteger("material.texture_specular1", 1);
 	shaderHouse.setInteger("material.texture_normal1", 2);
-	shaderHouse.setInteger("lightDepthTexture", 3);
+	shaderHouse.setInteger("shadowMap", 3);
 	shaderHouse.setFloat("material.shininess", 16.0f);
 	treeShader.setInteger("texturez", 0, true);
 	treeShader.setInteger("shadowMap", 3);
@@ -162,23 +170,36 @@ int main() {
     Terrain terrain;
     terrain.load(terrainWaterSize, 37.5f, 300.0f, "resources/textures/heightmap_island_low_poly.jpg");
     camera.loadTerrain(&terrain);
+    terrain.setShader(shaderTerrain, "grid", true);
+    terrain.setShader(shaderTerrainDepth, "grid", true);
 
     // Water
-    Water water(terrainWaterSize, waterHeight);
+    Water water(terrainWaterSize, waterHeight, SCR_WIDTH, SCR_HEIGHT);
     water.load("resources/textures/water_dudv_blur.jpg", "resources/textures/water_normal.jpg", 100.f);
+    // the distorted refraction hides a lower resolution well, the reflection follows the frame time
+    water.setRefractionResolution(WATER_RESOLUTION_HALF);
+    water.setReflectionResolution(WATER_RESOLUTION_DYNAMIC);
+    // WATER_SURFACE_FFT replaces the flat surface with simulated waves, at about 1.3 ms of CPU a frame
+    water.setSurface(WATER_SURFACE_FLAT);
 
     // Trees
     srand(2348);
-    std::vector<glm::mat4> trees;
+    std::vector<glm::vec2> treeLocs(NR_TREES);
     for (GLuint i = 0; i < NR_TREES; i++) {
         GLint x = rand() % (int)terrain.getSize().x - terrain.getSize().x * 0.5f;
         GLint z = rand() % (int)terrain.getSize().y - terrain.getSize().y * 0.5f;
-        float y = terrain.getHeight(x, z);
+        treeLocs[i] = glm::vec2(x, z);
+    }
+    std::vector<GLfloat> treeHeights(NR_TREES);
+    terrain.getHeights(&treeLocs[0], &treeHeights[0], NR_TREES);
+    std::vector<glm::mat4> trees;
+    for (GLuint i = 0; i < NR_TREES; i++) {
+        float y = treeHeights[i];
         if (y < water.getHeight() + 0.5f)
             continue;
         glm::mat4 model(1.f);
         GLfloat scale = TREE_SCALE + ((rand() % 25) - 7.5) / 10.0f;
-        model = glm::translate(model, glm::vec3(x, y - 0.05 * scale, z));
+        model = glm::translate(model, glm::vec3(treeLocs[i].x, y - 0.05 * scale, treeLocs[i].y));
         model = glm::scale(model, glm::vec3(scale));
         trees.push_back(model);
     }
@@ -197,6 +218,12 @@ int main() {
         model = glm::scale(model, glm::vec3(HOUSE_SCALE));
         housesModels.push_back(model);
     }
+    // bounding spheres of the houses, with the margin of Model::isInFrustum
+    FrustumCuller houseCuller;
+    for (GLuint i = 0; i < housesModels.size(); i++)
+        houseCuller.add(glm::vec3(housesModels[i] * glm::vec4(house.m_center, 1.f)), 2.f * house.m_radius * glm::length(glm::vec3(housesModels[i][0])));
+    // visible houses of each pass, refilled every frame in the same storage
+    std::vector<GLuint> visibleHouses, refractionHouses, reflectionHouses, shadowHouses;
 
     // Skybox
     Skybox skybox(&shaderSkybox);
@@ -219,29 +246,14 @@ int main() {
         "resources/skybox/night/front.png"
     );
 
-    // Shadow framebuffer
-    GLuint const SHADOW_RESOLUTION = 4096; //8192;//
-    GLuint ShadowFBO;
-
-    glGenFramebuffers(1, &ShadowFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, ShadowFBO);
-
-    Texture2D shadowDepth;
-    shadowDepth.Image_Format = GL_DEPTH_COMPONENT;
-    shadowDepth.Internal_Format = GL_DEPTH_COMPONENT;
-    shadowDepth.Filter_Min = GL_LINEAR;
-    // Manually set depth attachment to clamp to border value of 1.0 depth; ensures areas that are not visible from light are not in shadow.
-    shadowDepth.Wrap_S = GL_CLAMP_TO_BORDER;
-    shadowDepth.Wrap_T = GL_CLAMP_TO_BORDER;
-    shadowDepth.generate(SHADOW_RESOLUTION, SHADOW_RESOLUTION, NULL);
-    shadowDepth.bind();
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowDepth.ID, 0);
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "ERROR::SHADOW_FRAMEBUFFER" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // WATER_REFLECTION_SSR reflects what the normal pass already rendered and skips the reflection pass
+    water.setReflectionMode(WATER_REFLECTION_PLANAR, &skybox);
+
+    // Shadow map: cascaded, each cascade covers a slice of the view frustum up to SHADOW_DISTANCE
+    GLfloat const SHADOW_DISTANCE = 300.f; // the fog hides the shadows further away
+    GLfloat const SHADOW_SPLIT_LAMBDA = 0.75f; // 0: slices of equal length, 1: logarithmic slices
+    ShadowMap shadowMap(shadowResolution, SHADOW_DEPTH_24, near, SHADOW_DISTANCE, SHADOW_SPLIT_LAMBDA);
+    GLuint shadowTerrainRevision = terrain.getRevision(); // terrain of the static casters in the cache
 
     // Set Projection Matrix
     glm::mat4 projection = camera.SetProjectionMatrix((float)SCR_WIDTH, (float)SCR_HEIGHT, near, far); // this remains unchanged for every frame
@@ -266,28 +278,24 @@ int main() {
     fog.setShader(treeShader, "fog", true);
     fog.setShader(shaderSkybox, "fog", true);
 
-    // Trees - Instanced array
-    GLuint VBO_Trees;
-    glGenBuffers(1, &VBO_Trees);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_Trees);
-    glBufferData(GL_ARRAY_BUFFER, trees.size() * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+    // Trees - Instanced array, culled on the GPU into one list of trees.size() instances per pass:
+    // camera, refraction, reflection, then one per shadow cascade
+    InstanceCuller treeCuller(trees, tree.m_center, 2.f * tree.m_radius, 3 + SHADOW_CASCADES);
+    GLuint VBO_Trees = treeCuller.getBuffer();
     for (GLuint i = 0; i < tree.Meshes.size(); i++) {
         glBindVertexArray(tree.Meshes[i].VAO);
 
         glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(glm::vec4), (GLvoid*)0);
         glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(glm::vec4), (GLvoid*)(sizeof(glm::vec4)));
         glEnableVertexAttribArray(5);
-        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(glm::vec4), (GLvoid*)(2 * sizeof(glm::vec4)));
         glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(glm::vec4), (GLvoid*)(3 * sizeof(glm::vec4)));
 
         glVertexAttribDivisor(3, 1);
         glVertexAttribDivisor(4, 1);
         glVertexAttribDivisor(5, 1);
         glVertexAttribDivisor(6, 1);
     }
+    bindTreeInstances(tree, VBO_Trees, 0);
 
     // Render to Texture
     Framebuffer intermediateFramebuffer(SCR_WIDTH, SCR_HEIGHT);
@@ -308,6 +316,9 @@ int main() {
     volumetricFBO.ColorBuffer.Wrap_S = GL_CLAMP_TO_EDGE; // Clamp to edge so values do not leak into other sides of texture
     volumetricFBO.ColorBuffer.Wrap_T = GL_CLAMP_TO_EDGE;
 
+    // GPU time of each pass, shown in the window title with the FPS
+    GpuTimer gpuTimer;
+
     // deltaTime variables
     float lastTime{ 0.0f };
     float UpdateTime{ 0.0f };
@@ -321,79 +332,110 @@ int main() {
 
         if (UpdateTime > 1.f) {
             UpdateTime = 0.f;
-            glfwSetWindowTitle(window, ("Island  FPS : " + std::to_string(1.f / deltaTime)).c_str());
+            glfwSetWindowTitle(window, ("Island  FPS : " + std::to_string(1.f / deltaTime) + "  GPU : " + gpuTimer.report()).c_str());
         }
 
         processInput(window);
+        water.updateDynamicResolution(deltaTime);
 
         // configure view matrices
         glm::mat4 view = camera.GetViewMatrix();
         camera.CalculateViewFrustum();
+        camera.CalculateWaterFrustums(water.getHeight());
+        // the water passes are only needed when the water can be seen
+        bool waterVisible = water.isVisible(camera.Frustum);
+        bool reflectionPass = waterVisible && water.getReflectionMode() == WATER_REFLECTION_PLANAR;
+
+        // shadow cascades, the volume of each one culls its own shadow casters, visible or not
+        shadowMap.setResolution(shadowResolution);
+        shadowMap.update(camera, sun.m_direction);
+
+        // cull trees that are out of frustum, separately for each pass. It is done first, so that the GPU is
+        // done with it by the time the trees are drawn and their counts are read back
+        treeCuller.cull(0, camera.Frustum, 6);
+        if (waterVisible)
+            treeCuller.cull(1, camera.RefractionFrustum, 7);
+        if (reflectionPass)
+            treeCuller.cull(2, camera.ReflectionFrustum, 7);
+        for (GLuint cascade = 0; cascade < SHADOW_CASCADES; cascade++)
+            treeCuller.cull(3 + cascade, shadowMap.getFrustum(cascade), 6);
+
+        // cull houses that are out of frustum, for the camera and the water passes
+        houseCuller.cullIndices(camera.Frustum, 6, visibleHouses);
+        if (waterVisible)
+            houseCuller.cullIndices(camera.RefractionFrustum, 7, refractionHouses);
+        if (reflectionPass)
+            houseCuller.cullIndices(camera.ReflectionFrustum, 7, reflectionHouses);
+
+        if (waterVisible)
+            water.update(currentTime, camera.Position);
         glm::mat4 matProjectionView = projection * view;
-
-        // cull trees that are out of frustum
-        std::vector<glm::mat4> treeModels;
-        for (GLuint i = 0; i < trees.size(); i++) {
-            if (tree.isInFrustum(camera, trees[i]))
-                treeModels.push_back(trees[i]);
-        }
-        if (treeModels.size() > 0) {
-            glBindBuffer(GL_ARRAY_BUFFER, VBO_Trees);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, treeModels.size() * sizeof(glm::mat4), &treeModels[0]);
-        }
+        terrain.update(camera, (float)SCR_HEIGHT);
 
 #pragma region SHADOW
         /////////////////////////////////////////////////////////
         ///////////////////  SHADOW PASS  ///////////////////////
         /////////////////////////////////////////////////////////
 
-        glViewport(0, 0, SHADOW_RESOLUTION, SHADOW_RESOLUTION);
-        glBindFramebuffer(GL_FRAMEBUFFER, ShadowFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-
-        glm::mat4 lightMatrix;
-        GLfloat orthoWidth = 150.0f;
-        glm::mat4 lightProjection = glm::ortho(-orthoWidth, orthoWidth, -orthoWidth, orthoWidth, 25.0f, 350.0f);
-        glm::mat4 lightView = glm::lookAt(sun.m_direction * 250.f + glm::vec3(camera.Position.x, 0.0f, camera.Position.z),
-            glm::vec3(0.0f) + glm::vec3(camera.Position.x, 0.0f, camera.Position.z),
-            glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::mat4 biasMatrix = glm::mat4();
-        biasMatrix[0][0] = 0.5; biasMatrix[0][1] = 0.0; biasMatrix[0][2] = 0.0; biasMatrix[0][3] = 0.0;
-        biasMatrix[1][0] = 0.0; biasMatrix[1][1] = 0.5; biasMatrix[1][2] = 0.0; biasMatrix[1][3] = 0.0;
-        biasMatrix[2][0] = 0.0; biasMatrix[2][1] = 0.0; biasMatrix[2][2] = 0.5; biasMatrix[2][3] = 0.0;
-        biasMatrix[3][0] = 0.5; biasMatrix[3][1] = 0.5; biasMatrix[3][2] = 0.5; biasMatrix[3][3] = 1.0;
-        lightMatrix = lightProjection * lightView; // Render texture as full texture, add bias only to final matrix (to reposition vertex to 0.0 - 1.0f space)
-
-        /***********************Terrain*********************/
-        SimpleShader.use();
-        SimpleShader.setMatrix4("lightMatrix", lightMatrix);
-        SimpleShader.setMatrix4("model", glm::mat4(1.0f));
-        terrain.render();
-
-        /***********************Houses*********************/
-        for (GLuint i = 0; i < housesModels.size(); i++) {
-            SimpleShader.setMatrix4("model", housesModels[i]);
-            house.Draw(SimpleShader);
+        // the cached static casters hold the terrain as it was: edited, reloaded or moved (clipmap), render them again
+        if (terrain.getRevision() != shadowTerrainRevision) {
+            shadowMap.invalidate();
+            shadowTerrainRevision = terrain.getRevision();
         }
 
-        /***********************Trees*********************/
-        if (treeModels.size() > 0) {
-            glDisable(GL_CULL_FACE);
-            treeSimpleShader.use();
-            treeSimpleShader.setMatrix4("lightMatrix", lightMatrix);
-            treeSimpleShader.setFloat("time", glfwGetTime());
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, tree.Meshes[0].textures[0].id);
-            for (GLuint i = 0; i < tree.Meshes.size(); i++) {
-                glBindVertexArray(tree.Meshes[i].VAO);
-                glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, treeModels.size());
+        gpuTimer.begin("shadow");
+        shadowMap.begin();
+        for (GLuint cascade = 0; cascade < SHADOW_CASCADES; cascade++) {
+            const glm::mat4& lightMatrix = shadowMap.getLightMatrix(cascade);
+
+            // static casters, cached
+            if (shadowMap.beginStatic(cascade)) {
+                /***********************Terrain*********************/
+                shaderTerrainDepth.use();
+                shaderTerrainDepth.setMatrix4("lightMatrix", lightMatrix);
+                // at a LOD which does not follow the camera, the cache is kept while it moves
+                terrain.renderFixedLod(shadowMap.getFrustum(cascade), 6, shadowMap.getTexelSize(cascade));
+
+                /***********************Houses*********************/
+                SimpleShader.use();
+                SimpleShader.setMatrix4("lightMatrix", lightMatrix);
+                houseCuller.cullIndices(shadowMap.getFrustum(cascade), 6, shadowHouses);
+                for (GLuint i : shadowHouses) {
+                    SimpleShader.setMatrix4("model", housesModels[i]);
+                    house.Draw(SimpleShader);
+                }
+            }
+
+            // copy of the cache, then the dynamic casters
+            shadowMap.beginDynamic(cascade);
+
+            /***********************Trees*********************/
+            GLuint shadowTreeCount = treeCuller.getCount(3 + cascade);
+            if (shadowTreeCount > 0) {
+                glDisable(GL_CULL_FACE);
+                bindTreeInstances(tree, VBO_Trees, (3 + cascade) * trees.size());
+                treeSimpleShader.use();
+                treeSimpleShader.setMatrix4("lightMatrix", lightMatrix);
+                treeSimpleShader.setFloat("time", glfwGetTime());
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, tree.Meshes[0].textures[0].id);
+                for (GLuint i = 0; i < tree.Meshes.size(); i++) {
+                    glBindVertexArray(tree.Meshes[i].VAO);
+                    glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, shadowTreeCount);
+                }
+                glEnable(GL_CULL_FACE);
             }
-            glEnable(GL_CULL_FACE);
         }
+        bindTreeInstances(tree, VBO_Trees, 0);
+        shadowMap.end(SCR_WIDTH, SCR_HEIGHT);
+        gpuTimer.end();
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-        lightMatrix = biasMatrix * lightMatrix; // Add bias to lightMatrix (convert NDC to [0.0, 1.0] interval)
+        // the same cascades for all the passes, shadowMap of terrain.fs is on unit 1, the one of house.fs and tree.fs on unit 3
+        shadowMap.bind(1);
+        shadowMap.bind(3);
+        shadowMap.setShader(shaderTerrain, true);
+        shadowMap.setShader(shaderHouse, true);
+        shadowMap.setShader(treeShader, true);
 
 #pragma endregion SHADOW
 
@@ -402,20 +444,53 @@ int main() {
         ///////////////////  REFRACTION PASS  /////////////////////
         ///////////////////////////////////////////////////////////
 
-        water.initPassRefraction();
+        if (waterVisible)
+        {
+            gpuTimer.begin("refraction");
+            water.initPassRefraction();
 
-        /**********************Terrain********************/
-        shaderTerrain.setMatrix4("view", view, GL_TRUE);
-        shaderTerrain.setInteger("isRefraction", GL_TRUE);
-        shaderTerrain.setInteger("isReflection", GL_FALSE);
-        shaderTerrain.setFloat("waterHeight", water.getHeight());
-        shaderTerrain.setMatrix4("shadowMat", lightMatrix);
-        shaderTerrain.setVector3f("viewPos", camera.Position);
-        textureTerrain.bind(0);
-        shadowDepth.bind(1);
-        terrain.render();
+            /**********************Terrain********************/
+            shaderTerrain.setMatrix4("view", view, GL_TRUE);
+            shaderTerrain.setInteger("isRefraction", GL_TRUE);
+            shaderTerrain.setInteger("isReflection", GL_FALSE);
+            shaderTerrain.setFloat("waterHeight", water.getHeight());
+            shaderTerrain.setVector3f("viewPos", camera.Position);
+            textureTerrain.bind(0);
+            terrain.render(camera.RefractionFrustum, 7);
 
-        water.terminatePassRefraction();
+            /***********************Houses*********************/
+            glm::vec4 refractionClip = glm::vec4(0.f, -1.f, 0.f, water.getHeight() + WATER_REFRACTION_CLIP);
+            shaderHouse.setMatrix4("view", view, GL_TRUE);
+            shaderHouse.setVector3f("viewPos", camera.Position);
+            shaderHouse.setVector4f("clipPlane", refractionClip);
+            for (GLuint i : refractionHouses) {
+                shaderHouse.setMatrix4("model", housesModels[i]);
+                house.Draw(shaderHouse);
+            }
+
+            /**********************Trees********************/
+            GLuint refractionTreeCount = treeCuller.getCount(1);
+            if (refractionTreeCount > 0)
+            {
+                glDisable(GL_CULL_FACE);
+                treeShader.setMatrix4("view", view, GL_TRUE);
+                treeShader.setVector3f("viewPos", camera.Position);
+                treeShader.setFloat("time", glfwGetTime());
+                treeShader.setVector4f("clipPlane", refractionClip);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, tree.Meshes[0].textures[0].id);
+                bindTreeInstances(tree, VBO_Trees, trees.size());
+                for (GLuint i = 0; i < tree.Meshes.size(); ++i)
+                {
+                    glBindVertexArray(tree.Meshes[i].VAO);
+                    glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, refractionTreeCount);
+                }
+                glEnable(GL_CULL_FACE);
+            }
+
+            water.terminatePassRefraction();
+            gpuTimer.end();
+        }
 
 #pragma endregion REFRACTION
 
@@ -424,48 +499,66 @@ int main() {
         ///////////////////  REFLECTION PASS  /////////////////////
         ///////////////////////////////////////////////////////////
 
-        // now use a imaginary camera on the counter position under watersurface
-        glm::mat4 imgView = camera.GetImaginaryViewMatrix(water.getHeight());
+        if (reflectionPass)
+        {
+            // now use a imaginary camera on the counter position under watersurface
+            glm::mat4 imgView = camera.GetImaginaryViewMatrix(water.getHeight());
 
-        water.initPassReflection();
+            gpuTimer.begin("reflection");
+            water.initPassReflection();
 
-        /**********************Terrain********************/
-        shaderTerrain.setMatrix4("view", imgView, GL_TRUE);
-        shaderTerrain.setInteger("isRefraction", GL_FALSE);
-        shaderTerrain.setInteger("isReflection", GL_TRUE);
-        shaderTerrain.setFloat("waterHeight", water.getHeight());
-        shaderTerrain.setMatrix4("shadowMat", lightMatrix);
-        shaderTerrain.setVector3f("viewPos", camera.Position);
-        textureTerrain.bind(0);
-        shadowDepth.bind(1);
-        terrain.render();
+            /**********************Terrain********************/
+            shaderTerrain.setMatrix4("view", imgView, GL_TRUE);
+            shaderTerrain.setInteger("isRefraction", GL_FALSE);
+            shaderTerrain.setInteger("isReflection", GL_TRUE);
+            shaderTerrain.setFloat("waterHeight", water.getHeight());
+            shaderTerrain.setVector3f("viewPos", camera.Position);
+            textureTerrain.bind(0);
+            terrain.render(camera.ReflectionFrustum, 7);
 
-        /**********************Trees********************/
-        if (treeModels.size() > 0)
-        {
-            glDisable(GL_CULL_FACE);
-            treeShader.setMatrix4("view", imgView, GL_TRUE);
-            treeShader.setVector3f("viewPos", camera.Position);
-            treeShader.setFloat("time", glfwGetTime());
-            treeShader.setMatrix4("shadowMat", lightMatrix);
-            shadowDepth.bind(3);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, tree.Meshes[0].textures[0].id);
-            for (GLuint i = 0; i < tree.Meshes.size(); ++i)
+            /***********************Houses*********************/
+            glm::vec4 reflectionClip = glm::vec4(0.f, 1.f, 0.f, -water.getHeight() - WATER_REFLECTION_CLIP);
+            shaderHouse.setMatrix4("view", imgView, GL_TRUE);
+            shaderHouse.setVector3f("viewPos", camera.Position);
+            shaderHouse.setVector4f("clipPlane", reflectionClip);
+            for (GLuint i : reflectionHouses) {
+                shaderHouse.setMatrix4("model", housesModels[i]);
+                house.Draw(shaderHouse);
+            }
+
+            /**********************Trees********************/
+            GLuint reflectionTreeCount = treeCuller.getCount(2);
+            if (reflectionTreeCount > 0)
             {
-                glBindVertexArray(tree.Meshes[i].VAO);
-                glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, treeModels.size());
+                glDisable(GL_CULL_FACE);
+                treeShader.setMatrix4("view", imgView, GL_TRUE);
+                treeShader.setVector3f("viewPos", camera.Position);
+                treeShader.setFloat("time", glfwGetTime());
+                treeShader.setVector4f("clipPlane", reflectionClip);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, tree.Meshes[0].textures[0].id);
+                bindTreeInstances(tree, VBO_Trees, 2 * trees.size());
+                for (GLuint i = 0; i < tree.Meshes.size(); ++i)
+                {
+                    glBindVertexArray(tree.Meshes[i].VAO);
+                    glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, reflectionTreeCount);
+                }
+                glEnable(GL_CULL_FACE);
             }
-            glEnable(GL_CULL_FACE);
-        }
 
-        /***********************Skybox*********************/
-        skybox.render(imgView, projection, 1.f);
+            /***********************Skybox*********************/
+            skybox.render(imgView, projection, 1.f);
 
-        water.terminatePassReflection();
+            water.terminatePassReflection();
+            gpuTimer.end();
+        }
 
 #pragma endregion REFLECTION
 
+        // the following passes draw the camera list of trees
+        bindTreeInstances(tree, VBO_Trees, 0);
+        GLuint treeCount = treeCuller.getCount(0);
+
         // Check if the sun is in our sight. If not, skip GOD RAYS pass and POST PROCESSING pass.
         glm::vec4 position = projection * glm::mat4(glm::mat3(view)) * glm::vec4(sun.m_direction * 250.f, 1.f);
         float zValue = position.z;
@@ -484,26 +577,26 @@ int main() {
 
         if (doGodRays)
         {
+            gpuTimer.begin("god rays");
             intermediateFramebuffer.beginRender();
 
             SimpleShader.use();
             SimpleShader.setMatrix4("lightMatrix", matProjectionView);
 
             /***********************Houses*********************/
-            for (GLuint i = 0; i < housesModels.size(); i++)
+            for (GLuint i : visibleHouses)
             {
-                if (house.isInFrustum(camera, housesModels[i]))
-                {
-                    SimpleShader.setMatrix4("model", housesModels[i]);
-                    house.Draw(SimpleShader);
-                }
+                SimpleShader.setMatrix4("model", housesModels[i]);
+                house.Draw(SimpleShader);
             }
 
             /**********************Terrain********************/
-            SimpleShader.setMatrix4("model", glm::mat4(1.f));
-            terrain.render();
+            shaderTerrainDepth.use();
+            shaderTerrainDepth.setMatrix4("lightMatrix", matProjectionView);
+            terrain.render(camera.Frustum);
 
             /***********************Water*********************/
+            SimpleShader.use();
             glm::mat4 model(1.f);
             model = glm::translate(model, glm::vec3(0.0f, water.getHeight(), 0.0f));
             model = glm::scale(model, glm::vec3(water.getSize().x, 1.0f, water.getSize().y));
@@ -512,7 +605,7 @@ int main() {
             glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
             /**********************Trees********************/
-            if (treeModels.size() > 0)
+            if (treeCount > 0)
             {
                 glDisable(GL_CULL_FACE);
                 treeSimpleShader.use();
@@ -522,7 +615,7 @@ int main() {
                 for (GLuint i = 0; i < tree.Meshes.size(); ++i)
                 {
                     glBindVertexArray(tree.Meshes[i].VAO);
-                    glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, treeModels.size());
+                    glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, treeCount);
                 }
                 glEnable(GL_CULL_FACE);
             }
@@ -535,6 +628,7 @@ int main() {
             Geometry::drawPlane();
 
             intermediateFramebuffer.endRender();
+            gpuTimer.end();
         }
 
 #pragma endregion GOD_RAYS
@@ -544,6 +638,7 @@ int main() {
         /////////////////////  NORMAL PASS  ///////////////////////
         ///////////////////////////////////////////////////////////
 
+        gpuTimer.begin("normal");
         if (doGodRays)
             normalFramebuffer.beginRender();
         else {
@@ -555,43 +650,31 @@ int main() {
         shaderTerrain.setMatrix4("view", view, GL_TRUE);
         shaderTerrain.setInteger("isRefraction", GL_FALSE);
         shaderTerrain.setInteger("isReflection", GL_FALSE);
-        shaderTerrain.setMatrix4("shadowMat", lightMatrix);
         shaderTerrain.setVector3f("viewPos", camera.Position);
         textureTerrain.bind(0);
-        shadowDepth.bind(1);
-        terrain.render();
-
-        /***********************Water*********************/
-        water.m_shader.setMatrix4("view", view, GL_TRUE);
-        water.m_shader.setFloat("time", glfwGetTime() / 10.f);
-        water.m_shader.setVector3f("viewPos", camera.Position);
-        water.render();
+        terrain.render(camera.Frustum);
 
         /***********************Houses*********************/
         shaderHouse.setMatrix4("view", view, GL_TRUE);
         shaderHouse.setVector3f("viewPos", camera.Position);
-        for (GLuint i = 0; i < housesModels.size(); i++) {
-            if (house.isInFrustum(camera, housesModels[i])) {
-                shaderHouse.setMatrix4("model", housesModels[i]);
-                house.Draw(shaderHouse);
-            }
+        for (GLuint i : visibleHouses) {
+            shaderHouse.setMatrix4("model", housesModels[i]);
+            house.Draw(shaderHouse);
         }
 
         /**********************Trees********************/
-        if (treeModels.size() > 0)
+        if (treeCount > 0)
         {
             glDisable(GL_CULL_FACE);
             treeShader.setMatrix4("view", view, GL_TRUE);
             treeShader.setVector3f("viewPos", camera.Position);
             treeShader.setFloat("time", glfwGetTime());
-            treeShader.setMatrix4("shadowMat", lightMatrix);
-            shadowDepth.bind(3);
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, tree.Meshes[0].textures[0].id);
             for (GLuint i = 0; i < tree.Meshes.size(); ++i)
             {
                 glBindVertexArray(tree.Meshes[i].VAO);
-                glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, treeModels.size());
+                glDrawElementsInstanced(GL_TRIANGLES, tree.Meshes[i].indices.size(), GL_UNSIGNED_INT, 0, treeCount);
             }
             glEnable(GL_CULL_FACE);
         }
@@ -599,8 +682,16 @@ int main() {
         /***********************Skybox*********************/
         skybox.render(view, projection, 1.f);
 
+        /***********************Water*********************/
+        // last, the SSR reflections read everything else back from the framebuffer
+        water.m_shader.setMatrix4("view", view, GL_TRUE);
+        water.m_shader.setFloat("time", glfwGetTime() / 10.f);
+        water.m_shader.setVector3f("viewPos", camera.Position);
+        water.render();
+
         if (doGodRays)
             normalFramebuffer.endRender();
+        gpuTimer.end();
 
 #pragma endregion NORMAL
 
@@ -611,6 +702,7 @@ int main() {
 
         if (doGodRays)
         {
+            gpuTimer.begin("post processing");
             glDisable(GL_DEPTH_TEST);
 
             volumetricFBO.beginRender();
@@ -656,11 +748,13 @@ int main() {
             Geometry::drawPlane();
 
             glEnable(GL_DEPTH_TEST);
+            gpuTimer.end();
         }
 
 #pragma endregion POST_PROCESSING
 
         drawDebugPlane(water.m_texReflection.ID);
+        gpuTimer.endFrame();
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
@@ -690,6 +784,15 @@ void processInput(GLFWwindow* window)
         camera.ProcessKeyboard(LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera.ProcessKeyboard(RIGHT, deltaTime);
+    //shadow resolution
+    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
+        shadowResolution = 512;
+    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
+        shadowResolution = 1024;
+    if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
+        shadowResolution = 2048;
+    if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS)
+        shadowResolution = 4096;
     if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
         cursorFlag = !cursorFlag;
         if (cursorFlag)
@@ -761,4 +864,17 @@ void drawDebugPlane(GLuint textureID)
     glBindVertexArray(0);
 }
 
+// Points the instanced model matrices of every mesh of tree at the instances of VBO starting at first
+void bindTreeInstances(Model& tree, GLuint VBO, GLuint first)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    for (GLuint i = 0; i < tree.Meshes.size(); i++) {
+        glBindVertexArray(tree.Meshes[i].VAO);
+        for (GLuint column = 0; column < 4; column++)
+            glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(first * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 //#endif
\ No newline at end of file
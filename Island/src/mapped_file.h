@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+/* Read-only memory mapping of a whole file, the pages are only read from disk when touched.
+Used to hand cached blobs to OpenGL without copying them first. */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    // Returns false if the file does not exist or cannot be mapped
+    bool open(const std::string& path);
+    void close();
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+private:
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr; // HANDLE
+    void* m_mapping = nullptr; // HANDLE
+#endif
+};
@@ -72,13 +72,19 @@ public:
 
     // Check if it requires frustum culling
     bool isInFrustum(Camera& camera, glm::mat4& model)
+    {
+        return isInFrustum(camera.Frustum, 6, model);
+    }
+
+    // Same as above with any planes, e.g. the frustums of the water passes
+    bool isInFrustum(const Plane* frustum, const GLuint& planeCount, glm::mat4& model)
     {
         glm::vec3 center = glm::vec3(model * glm::vec4(m_center, 1.f)); // ı任ռ
         float radius = 2.f * m_radius * model[0][0]; // Ensure the shadow can last a while when the object goes out of sight(frustum)
         // Check if sphere touches any part of frustum
-        for (GLuint i = 0; i < 6; ++i)
+        for (GLuint i = 0; i < planeCount; ++i)
         {
-            if (camera.Frustum[i].Distance(center) < -radius) // ͸ͷÿǸֵΪ߳ڣע⣬Ƚϵ-radius
+            if (frustum[i].Distance(center) < -radius) // ͸ͷÿǸֵΪ߳ڣע⣬Ƚϵ-radius
                 return false;
         }
         return true; // ͨ͸ͷÿļ
@@ -0,0 +1,337 @@
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <iostream>
+
+#include "ocean.h"
+
+static const GLfloat GRAVITY = 9.81f;
+static const GLfloat PI = 3.14159265358979f;
+// vertices of one grid level, the base vertex of level l is l * OCEAN_GRID_VERTICES so that gl_VertexID gives the level back
+static const GLuint OCEAN_GRID_VERTICES = (OCEAN_GRID_SIZE + 1) * (OCEAN_GRID_SIZE + 1);
+
+// 4 lanes arithmetic on registers loaded from Lanes, SSE or scalar
+#ifdef OCEAN_SSE
+typedef __m128 LaneRegister;
+#define LANES_LOAD(a) _mm_load_ps((a).v)
+#define LANES_STORE(dst, a) _mm_store_ps((dst).v, a)
+#define LANES_ADD(a, b) _mm_add_ps(a, b)
+#define LANES_SUB(a, b) _mm_sub_ps(a, b)
+#define LANES_MUL(a, b) _mm_mul_ps(a, b)
+#define LANES_SET1(x) _mm_set1_ps(x)
+#else
+struct LaneRegister { GLfloat v[4]; };
+static inline LaneRegister lanesAdd(const LaneRegister& a, const LaneRegister& b) {
+    return LaneRegister{ { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } };
+}
+static inline LaneRegister lanesSub(const LaneRegister& a, const LaneRegister& b) {
+    return LaneRegister{ { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } };
+}
+static inline LaneRegister lanesMul(const LaneRegister& a, const LaneRegister& b) {
+    return LaneRegister{ { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } };
+}
+#define LANES_LOAD(a) LaneRegister{ { (a).v[0], (a).v[1], (a).v[2], (a).v[3] } }
+#define LANES_STORE(dst, a) memcpy((dst).v, (a).v, sizeof(LaneRegister))
+#define LANES_ADD(a, b) lanesAdd(a, b)
+#define LANES_SUB(a, b) lanesSub(a, b)
+#define LANES_MUL(a, b) lanesMul(a, b)
+#define LANES_SET1(x) LaneRegister{ { x, x, x, x } }
+#endif
+
+Ocean::Ocean(const GLfloat& patchSize, const glm::vec2& wind, const GLfloat& waveHeight, const GLfloat& choppiness,
+    const GLfloat& spacing, const GLuint& levelCount, const GLuint& seed)
+    : m_patchSize(patchSize), m_choppiness(choppiness), m_spacing(spacing),
+    m_levelCount(glm::clamp(levelCount, 1u, OCEAN_GRID_LEVELS_MAX)), m_pool(&ThreadPool::shared()), m_origins(m_levelCount) {
+    if (levelCount != m_levelCount)
+        std::cout << "ERROR::OCEAN: Grid level count clamped to " << m_levelCount << std::endl;
+
+    const GLuint N = OCEAN_FFT_SIZE;
+    m_real.resize(N * N);
+    m_imag.resize(N * N);
+    m_displacement.resize(N * N * 3);
+    m_slopes.resize(N * N * 3);
+    m_twiddles.resize(N / 2);
+    for (GLuint k = 0; k < N / 2; k++)
+        m_twiddles[k] = std::polar(1.f, 2.f * PI * k / N);
+    m_bitReversed.resize(N);
+    GLuint bits = 0;
+    while ((1u << bits) < N)
+        bits++;
+    for (GLuint i = 0; i < N; i++) {
+        GLuint reversed = 0;
+        for (GLuint bit = 0; bit < bits; bit++)
+            reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+        m_bitReversed[i] = reversed;
+    }
+    generateSpectrum(wind, waveHeight, seed);
+
+    // mipmapped so that the coarse grid levels and the far pixels get the waves averaged instead of aliased
+    GLuint* textures[] = { &m_displacementTexture, &m_slopeTexture };
+    for (GLuint* texture : textures) {
+        glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, N, N, 0, GL_RGB, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // one grid of SIZE x SIZE cells, row by row, with the triangles of TerrainClipmap
+    const GLuint M = OCEAN_GRID_SIZE;
+    std::vector<GLushort> indices;
+    indices.reserve(M * M * 6);
+    for (GLuint i = 0; i < M; i++) {
+        for (GLuint j = 0; j < M; j++) {
+            indices.push_back(i * (M + 1) + j);
+            indices.push_back((i + 1) * (M + 1) + j);
+            indices.push_back(i * (M + 1) + j + 1);
+
+            indices.push_back(i * (M + 1) + j + 1);
+            indices.push_back((i + 1) * (M + 1) + j);
+            indices.push_back((i + 1) * (M + 1) + j + 1);
+        }
+    }
+    glGenVertexArrays(1, &m_VAO);
+    glGenBuffers(1, &m_EBO);
+    glBindVertexArray(m_VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    simulate(0.f);
+    update(glm::vec3(0.f));
+}
+
+Ocean::~Ocean() {
+    glDeleteTextures(1, &m_displacementTexture);
+    glDeleteTextures(1, &m_slopeTexture);
+    glDeleteVertexArrays(1, &m_VAO);
+    glDeleteBuffers(1, &m_EBO);
+}
+
+void Ocean::simulate(const float& time) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const GLuint N = OCEAN_FFT_SIZE;
+    // rows, then columns. Each row of the spectrum is transformed as soon as it is evaluated
+    m_pool->parallelFor(0, N, [&](GLuint rowBegin, GLuint rowEnd) {
+        evaluateSpectrum(time, rowBegin, rowEnd);
+        for (GLuint row = rowBegin; row < rowEnd; row++)
+            inverseFFT(&m_real[row * N], &m_imag[row * N], 1, 1);
+    });
+    // the columns of a band are transformed side by side, so that the memory is read row by row
+    m_pool->parallelFor(0, N, [&](GLuint colBegin, GLuint colEnd) {
+        inverseFFT(&m_real[colBegin], &m_imag[colBegin], N, colEnd - colBegin);
+    });
+    m_pool->parallelFor(0, N, [&](GLuint rowBegin, GLuint rowEnd) {
+        pack(rowBegin, rowEnd);
+    });
+    m_simulationTime = std::chrono::duration<GLdouble, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    glBindTexture(GL_TEXTURE_2D, m_displacementTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RGB, GL_FLOAT, &m_displacement[0]);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, m_slopeTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RGB, GL_FLOAT, &m_slopes[0]);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Ocean::update(const glm::vec3& position) {
+    const GLint M = OCEAN_GRID_SIZE;
+    m_center = position;
+    // same levels as TerrainClipmap::update(), without anything to upload
+    for (GLuint level = 0; level < m_levelCount; level++) {
+        GLfloat levelSpacing = m_spacing * (1u << level);
+        m_origins[level] = 2 * glm::ivec2(glm::floor((glm::vec2(position.x, position.z) / levelSpacing - M * 0.5f) * 0.5f));
+    }
+    m_drawCounts.clear();
+    m_drawOffsets.clear();
+    m_drawBaseVertices.clear();
+    pushRows(0, 0, 0, M, M);
+    for (GLuint level = 1; level < m_levelCount; level++) {
+        glm::ivec2 hole = m_origins[level - 1] / 2 - m_origins[level];
+        pushRows(level, 0, 0, hole.y, M);
+        pushRows(level, hole.y, 0, M / 2, hole.x);
+        pushRows(level, hole.y, hole.x + M / 2, M / 2, M / 2 - hole.x);
+        pushRows(level, hole.y + M / 2, 0, M / 2 - hole.y, M);
+    }
+}
+
+void Ocean::render() {
+    glActiveTexture(GL_TEXTURE0 + OCEAN_DISPLACEMENT_UNIT);
+    glBindTexture(GL_TEXTURE_2D, m_displacementTexture);
+    glActiveTexture(GL_TEXTURE0 + OCEAN_SLOPE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, m_slopeTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(m_VAO);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &m_drawCounts[0], GL_UNSIGNED_SHORT, &m_drawOffsets[0], m_drawCounts.size(), &m_drawBaseVertices[0]);
+    glBindVertexArray(0);
+}
+
+void Ocean::setShader(Shader& shader, std::string Name, GLboolean UseShader) {
+    if (UseShader)
+        shader.use();
+    shader.setInteger((Name + ".levels").c_str(), m_levelCount);
+    shader.setFloat((Name + ".spacing").c_str(), m_spacing);
+    shader.setVector2f((Name + ".center").c_str(), m_center.x, m_center.z);
+    for (GLuint level = 0; level < m_levelCount; level++)
+        shader.setVector2f((Name + ".origins[" + std::to_string(level) + "]").c_str(), glm::vec2(m_origins[level]));
+    shader.setFloat((Name + ".patchSize").c_str(), m_patchSize);
+    shader.setInteger("oceanDisplacement", OCEAN_DISPLACEMENT_UNIT);
+    shader.setInteger("oceanSlopes", OCEAN_SLOPE_UNIT);
+}
+
+// Phillips spectrum, scaled so that the heights have the requested RMS value
+void Ocean::generateSpectrum(const glm::vec2& wind, const GLfloat& waveHeight, const GLuint& seed) {
+    const GLuint N = OCEAN_FFT_SIZE;
+    GLfloat windSpeed = glm::length(wind);
+    glm::vec2 windDirection = wind / windSpeed;
+    GLfloat largestWave = windSpeed * windSpeed / GRAVITY;
+    GLfloat smallestWave = 0.5f * m_patchSize / N; // the waves shorter than a sample are damped
+    std::mt19937 random(seed);
+    std::normal_distribution<GLfloat> gaussian;
+
+    m_waveVectors.resize(N * N);
+    m_omega.resize(N * N);
+    m_h0.resize(N * N);
+    for (GLuint n = 0; n < N; n++) {
+        for (GLuint m = 0; m < N; m++) {
+            GLuint index = n * N + m;
+            glm::vec2 k = 2.f * PI / m_patchSize * glm::vec2((GLint)m - (GLint)N / 2, (GLint)n - (GLint)N / 2);
+            GLfloat length = glm::length(k);
+            m_waveVectors[index] = k;
+            m_omega[index] = std::sqrt(GRAVITY * length);
+            GLfloat xi0 = gaussian(random), xi1 = gaussian(random);
+            if (length < 1e-6f) {
+                m_h0[index] = 0.f;
+                continue;
+            }
+            GLfloat alignment = glm::dot(k / length, windDirection);
+            GLfloat phillips = std::exp(-1.f / (length * largestWave * length * largestWave)) / (length * length * length * length)
+                * alignment * alignment * std::exp(-length * length * smallestWave * smallestWave);
+            if (alignment < 0.f)
+                phillips *= 0.07f; // little waves going against the wind
+            m_h0[index] = std::complex<GLfloat>(xi0, xi1) * std::sqrt(phillips * 0.5f);
+        }
+    }
+
+    // h0(-k), the first row and column have no opposite in the grid
+    m_h0MinusConj.resize(N * N);
+    GLdouble variance = 0.0;
+    for (GLuint n = 0; n < N; n++) {
+        for (GLuint m = 0; m < N; m++) {
+            GLuint index = n * N + m;
+            m_h0MinusConj[index] = m == 0 || n == 0 ? 0.f : std::conj(m_h0[(N - n) * N + N - m]);
+            variance += std::norm(m_h0[index]) + std::norm(m_h0MinusConj[index]);
+        }
+    }
+    GLfloat scale = variance > 0.0 ? waveHeight / (GLfloat)std::sqrt(variance) : 0.f;
+    for (GLuint i = 0; i < N * N; i++) {
+        m_h0[i] *= scale;
+        m_h0MinusConj[i] *= scale;
+    }
+}
+
+// h(k, t) and its derivatives, in the lanes of the complex fields: (h + i Dx), (Dz + i dh/dx), (dh/dz + i dDx/dx), (dDz/dz + i dDx/dz).
+// Each pair of fields has a real transform, so packing them as a + i b gets both back from a single complex transform
+void Ocean::evaluateSpectrum(const float& time, const GLuint& rowBegin, const GLuint& rowEnd) {
+    const GLuint N = OCEAN_FFT_SIZE;
+    for (GLuint n = rowBegin; n < rowEnd; n++) {
+        for (GLuint m = 0; m < N; m++) {
+            GLuint index = n * N + m;
+            // h = h0 e^(i w t) + conj(h0(-k)) e^(-i w t), written out since std::complex products are slow without fast math
+            GLfloat cosine = std::cos(m_omega[index] * time), sine = std::sin(m_omega[index] * time);
+            const std::complex<GLfloat>& h0 = m_h0[index], & h0MinusConj = m_h0MinusConj[index];
+            GLfloat hReal = (h0.real() + h0MinusConj.real()) * cosine - (h0.imag() - h0MinusConj.imag()) * sine;
+            GLfloat hImag = (h0.imag() + h0MinusConj.imag()) * cosine + (h0.real() - h0MinusConj.real()) * sine;
+            glm::vec2 k = m_waveVectors[index];
+            GLfloat length = glm::length(k);
+            GLfloat inverse = length < 1e-6f ? 0.f : 1.f / length;
+            // D = i k / |k| h moves the samples towards the crests, its derivatives are -k k / |k| h.
+            // i a for a real factor a is (-a hImag, a hReal), and (a + i b) for the two fields of a lane is (a.re - b.im, a.im + b.re)
+            GLfloat dx = k.x * inverse, dz = k.y * inverse;
+            GLfloat dxx = -k.x * k.x * inverse, dzz = -k.y * k.y * inverse, dxz = -k.x * k.y * inverse;
+            // (h + i Dx), Dx = i dx h
+            GLfloat real0 = hReal - dx * hReal, imag0 = hImag - dx * hImag;
+            // (Dz + i dh/dx), Dz = i dz h, dh/dx = i k.x h
+            GLfloat real1 = -dz * hImag - k.x * hReal, imag1 = dz * hReal - k.x * hImag;
+            // (dh/dz + i dDx/dx), dh/dz = i k.y h
+            GLfloat real2 = -k.y * hImag - dxx * hImag, imag2 = k.y * hReal + dxx * hReal;
+            // (dDz/dz + i dDx/dz)
+            GLfloat real3 = dzz * hReal - dxz * hImag, imag3 = dzz * hImag + dxz * hReal;
+            m_real[index] = Lanes{ { real0, real1, real2, real3 } };
+            m_imag[index] = Lanes{ { imag0, imag1, imag2, imag3 } };
+        }
+    }
+}
+
+// Iterative radix-2 transforms with a positive exponent and no scaling, the 4 lanes at once.
+// Transform c has its sample i at i * stride + c
+void Ocean::inverseFFT(Lanes* real, Lanes* imag, const GLuint& stride, const GLuint& count) {
+    const GLuint N = OCEAN_FFT_SIZE;
+    for (GLuint i = 0; i < N; i++) {
+        GLuint j = m_bitReversed[i];
+        if (j <= i)
+            continue;
+        for (GLuint c = 0; c < count; c++) {
+            std::swap(real[i * stride + c], real[j * stride + c]);
+            std::swap(imag[i * stride + c], imag[j * stride + c]);
+        }
+    }
+    for (GLuint size = 2; size <= N; size *= 2) {
+        GLuint half = size / 2, step = N / size;
+        for (GLuint start = 0; start < N; start += size) {
+            for (GLuint k = 0; k < half; k++) {
+                LaneRegister wReal = LANES_SET1(m_twiddles[k * step].real()), wImag = LANES_SET1(m_twiddles[k * step].imag());
+                Lanes* aReal = &real[(start + k) * stride], * aImag = &imag[(start + k) * stride];
+                Lanes* bReal = &real[(start + k + half) * stride], * bImag = &imag[(start + k + half) * stride];
+                for (GLuint c = 0; c < count; c++) {
+                    LaneRegister aR = LANES_LOAD(aReal[c]), aI = LANES_LOAD(aImag[c]), bR = LANES_LOAD(bReal[c]), bI = LANES_LOAD(bImag[c]);
+                    LaneRegister tReal = LANES_SUB(LANES_MUL(wReal, bR), LANES_MUL(wImag, bI));
+                    LaneRegister tImag = LANES_ADD(LANES_MUL(wReal, bI), LANES_MUL(wImag, bR));
+                    LANES_STORE(bReal[c], LANES_SUB(aR, tReal));
+                    LANES_STORE(bImag[c], LANES_SUB(aI, tImag));
+                    LANES_STORE(aReal[c], LANES_ADD(aR, tReal));
+                    LANES_STORE(aImag[c], LANES_ADD(aI, tImag));
+                }
+            }
+        }
+    }
+}
+
+// Unpacks the transformed lanes into the texture layouts. The spectrum is centered on k = 0,
+// which multiplies sample (m, n) of the transform by (-1)^(m + n)
+void Ocean::pack(const GLuint& rowBegin, const GLuint& rowEnd) {
+    const GLuint N = OCEAN_FFT_SIZE;
+    const GLfloat lambda = m_choppiness;
+    for (GLuint n = rowBegin; n < rowEnd; n++) {
+        for (GLuint m = 0; m < N; m++) {
+            GLuint index = n * N + m;
+            const GLfloat* real = m_real[index].v, * imag = m_imag[index].v;
+            GLfloat sign = (n + m) & 1 ? -1.f : 1.f;
+            GLfloat dxx = sign * lambda * imag[2], dzz = sign * lambda * real[3], dxz = sign * lambda * imag[3];
+            m_displacement[index * 3] = sign * lambda * imag[0];
+            m_displacement[index * 3 + 1] = sign * real[0];
+            m_displacement[index * 3 + 2] = sign * lambda * real[1];
+            m_slopes[index * 3] = sign * imag[1];
+            m_slopes[index * 3 + 1] = sign * real[2];
+            m_slopes[index * 3 + 2] = (1.f + dxx) * (1.f + dzz) - dxz * dxz;
+        }
+    }
+}
+
+// Queues the rows x cols cells of a level starting at cell (row, col), see TerrainClipmap::pushRows()
+void Ocean::pushRows(const GLuint& level, const GLuint& row, const GLuint& col, const GLuint& rows, const GLuint& cols) {
+    const GLuint M = OCEAN_GRID_SIZE;
+    if (rows == 0 || cols == 0)
+        return;
+    GLuint drawRows = cols == M ? 1 : rows;
+    for (GLuint i = 0; i < drawRows; i++) {
+        m_drawCounts.push_back((cols == M ? rows : 1) * cols * 6);
+        m_drawOffsets.push_back(0);
+        m_drawBaseVertices.push_back(level * OCEAN_GRID_VERTICES + (row + i) * (M + 1) + col);
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <complex>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCEAN_SSE
+#include <emmintrin.h>
+#endif
+
+#include "shader.h"
+#include "thread_pool.h"
+
+// Samples per side of the simulation, a power of two. Must match ocean.glsl
+const GLuint OCEAN_FFT_SIZE = 128;
+// Cells per side of every level of the grid, must be even. Level l has a spacing of 2^l cells of level 0. Must match ocean.glsl
+const GLuint OCEAN_GRID_SIZE = 64;
+// must match the size of OceanGrid.origins in ocean.glsl
+const GLuint OCEAN_GRID_LEVELS_MAX = 10;
+// texture units the displacement and slope textures are bound to by render()
+const GLuint OCEAN_DISPLACEMENT_UNIT = 4;
+const GLuint OCEAN_SLOPE_UNIT = 5;
+
+/* Tessendorf ocean: a Phillips spectrum animated with the deep water dispersion and brought back to space
+with a 2D inverse FFT on the CPU, into two tiling textures of OCEAN_FFT_SIZE x OCEAN_FFT_SIZE samples:
+    - displacement: choppy horizontal displacement x, height, choppy displacement z
+    - slopes: dh/dx, dh/dz and the Jacobian of the horizontal displacement (below 0 where the waves fold, i.e. foam)
+The 8 real fields are packed two by two into 4 complex fields, transformed together, one per SSE lane.
+The surface is drawn as nested square rings of OCEAN_GRID_SIZE cells centered on the camera, each one twice as
+coarse as the previous one, with no vertex data: water.vs rebuilds the grid from gl_VertexID, see ocean.glsl. */
+class Ocean {
+public:
+    // patchSize: world size of the tiling patch, wind: direction and speed (m/s), waveHeight: RMS height of the waves,
+    // choppiness: scale of the horizontal displacement, spacing: cell size of the finest grid level
+    Ocean(const GLfloat& patchSize, const glm::vec2& wind, const GLfloat& waveHeight, const GLfloat& choppiness,
+        const GLfloat& spacing, const GLuint& levelCount, const GLuint& seed = 1);
+    ~Ocean();
+    Ocean(const Ocean&) = delete;
+    Ocean& operator=(const Ocean&) = delete;
+    // Evaluates the spectrum at time (seconds), transforms it and uploads both textures
+    void simulate(const float& time);
+    // Recenters the grid levels on position
+    void update(const glm::vec3& position);
+    void render();
+    // Sets the uniforms of ocean.glsl. The origins of the levels move in update(), so call it after each update()
+    void setShader(Shader& shader, std::string Name, GLboolean UseShader);
+    void setThreadPool(ThreadPool& pool) { m_pool = &pool; }
+    GLfloat getPatchSize() { return m_patchSize; }
+    // CPU time of the last simulate(), in milliseconds
+    GLdouble getSimulationTime() { return m_simulationTime; }
+private:
+    // 4 floats, loaded into an SSE register by the FFT (__m128 itself loses its alignment as a template argument)
+    struct alignas(16) Lanes { GLfloat v[4]; };
+    GLfloat m_patchSize;
+    GLfloat m_choppiness;
+    GLfloat m_spacing;
+    GLuint m_levelCount;
+    ThreadPool* m_pool;
+    GLdouble m_simulationTime = 0.0;
+    // spectrum at t = 0: h0(k) and conj(h0(-k)), angular frequency and wave vector of every sample
+    std::vector<std::complex<GLfloat>> m_h0, m_h0MinusConj;
+    std::vector<GLfloat> m_omega;
+    std::vector<glm::vec2> m_waveVectors;
+    // complex fields in split form, one field per lane: (h, Dx), (Dz, dh/dx), (dh/dz, dDx/dx), (dDz/dz, dDx/dz)
+    std::vector<Lanes> m_real, m_imag;
+    std::vector<std::complex<GLfloat>> m_twiddles; // e^(2i pi k / N), k < N / 2
+    std::vector<GLuint> m_bitReversed;
+    std::vector<GLfloat> m_displacement, m_slopes; // upload scratch, RGB
+    GLuint m_displacementTexture = 0, m_slopeTexture = 0;
+    // grid, see TerrainClipmap
+    GLuint m_VAO = 0, m_EBO = 0;
+    glm::vec3 m_center = glm::vec3(0.f);
+    std::vector<glm::ivec2> m_origins;
+    std::vector<GLsizei> m_drawCounts;
+    std::vector<const void*> m_drawOffsets;
+    std::vector<GLint> m_drawBaseVertices;
+
+    void generateSpectrum(const glm::vec2& wind, const GLfloat& waveHeight, const GLuint& seed);
+    void evaluateSpectrum(const float& time, const GLuint& rowBegin, const GLuint& rowEnd);
+    // In place inverse FFTs of N samples, stride elements apart, for count transforms side by side
+    void inverseFFT(Lanes* real, Lanes* imag, const GLuint& stride, const GLuint& count);
+    void pack(const GLuint& rowBegin, const GLuint& rowEnd);
+    void pushRows(const GLuint& level, const GLuint& row, const GLuint& col, const GLuint& rows, const GLuint& cols);
+};
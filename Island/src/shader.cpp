@@ -80,6 +80,13 @@ std::string Shader::preProcess(const char* shaderSource, std::string directory)
     return output.str();
 }
 
+void Shader::setFeedbackVaryings(const GLchar* const* varyings, GLsizei count)
+{
+    glTransformFeedbackVaryings(this->ID, count, varyings, GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(this->ID);
+    checkCompileErrors(this->ID, "PROGRAM");
+}
+
 void Shader::setFloat(const char* name, float value, bool useShader)
 {
     if (useShader)
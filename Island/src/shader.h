@@ -19,6 +19,8 @@ public:
 	// Compiles the shader from given source code
 	void compile(const char* vertexSource, const char* fragmentSource, const char* geometrySource = nullptr, std::string directory = "");
 	std::string preProcess(const char* shaderSource, std::string directory);
+	// Captures the given outputs of the last stage with transform feedback, interleaved, and links the program again
+	void setFeedbackVaryings(const GLchar* const* varyings, GLsizei count);
 	// utility functions
 	void setFloat(const char* name, float value, bool useShader = false);
 	void setInteger(const char* name, int value, bool useShader = false);
@@ -0,0 +1,175 @@
+#include <iostream>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shadow_map.h"
+
+// distance the cascades reach toward the light past the view, for the casters out of the view (hills, trees)
+const GLfloat SHADOW_CASTER_DISTANCE = 100.f;
+
+ShadowMap::ShadowMap(const GLuint& resolution, const ShadowDepthFormat& format, const GLfloat& nearDistance, const GLfloat& distance,
+    const GLfloat& splitLambda)
+    : m_resolution(glm::max(resolution, SHADOW_RESOLUTION_MIN)), m_format(format) {
+    for (GLuint i = 0; i <= SHADOW_CASCADES; i++) {
+        GLfloat t = (GLfloat)i / SHADOW_CASCADES;
+        m_splits[i] = glm::mix(nearDistance + (distance - nearDistance) * t, nearDistance * powf(distance / nearDistance, t), splitLambda);
+    }
+    allocate();
+}
+
+ShadowMap::~ShadowMap() {
+    release();
+}
+
+void ShadowMap::setResolution(const GLuint& resolution) {
+    if (glm::max(resolution, SHADOW_RESOLUTION_MIN) == m_resolution)
+        return;
+    m_resolution = glm::max(resolution, SHADOW_RESOLUTION_MIN);
+    release();
+    allocate();
+}
+
+void ShadowMap::setDepthFormat(const ShadowDepthFormat& format) {
+    if (format == m_format)
+        return;
+    m_format = format;
+    release();
+    allocate();
+}
+
+void ShadowMap::allocate() {
+    GLenum internalFormat = GL_DEPTH_COMPONENT24;
+    if (m_format == SHADOW_DEPTH_16)
+        internalFormat = GL_DEPTH_COMPONENT16;
+    else if (m_format == SHADOW_DEPTH_32F)
+        internalFormat = GL_DEPTH_COMPONENT32F;
+
+    GLuint FBOs[2], textures[2];
+    glGenFramebuffers(2, FBOs);
+    glGenTextures(2, textures);
+    for (GLuint i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, m_resolution, m_resolution, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // clamp to a border of 1.0 depth, so that the areas out of the cascade are not in shadow
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+        // read through a sampler2DArrayShadow: every fetch compares the 4 nearest texels and filters the results (hardware PCF)
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBOs[i]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[i], 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW_MAP: Framebuffer not complete" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    m_FBO = FBOs[0]; m_texture = textures[0];
+    m_cacheFBO = FBOs[1]; m_cacheTexture = textures[1];
+    invalidate();
+}
+
+void ShadowMap::invalidate() {
+    for (GLuint cascade = 0; cascade < SHADOW_CASCADES; cascade++)
+        m_cacheValid[cascade] = false;
+}
+
+void ShadowMap::release() {
+    glDeleteFramebuffers(1, &m_FBO);
+    glDeleteFramebuffers(1, &m_cacheFBO);
+    glDeleteTextures(1, &m_texture);
+    glDeleteTextures(1, &m_cacheTexture);
+    m_FBO = m_cacheFBO = m_texture = m_cacheTexture = 0;
+}
+
+void ShadowMap::update(Camera& camera, const glm::vec3& lightDir) {
+    for (GLuint cascade = 0; cascade < SHADOW_CASCADES; cascade++) {
+        glm::vec3 corners[8];
+        camera.GetFrustumCorners(m_splits[cascade], m_splits[cascade + 1], corners);
+        m_lightMatrices[cascade] = fitCascade(corners, lightDir, m_frustums[cascade], m_texelSizes[cascade]);
+    }
+}
+
+void ShadowMap::begin() {
+    glViewport(0, 0, m_resolution, m_resolution);
+}
+
+bool ShadowMap::beginStatic(const GLuint& cascade) {
+    // only when the cascade moved or the light turned since the cache was rendered
+    if (m_cacheValid[cascade] && m_lightMatrices[cascade] == m_cachedLightMatrices[cascade])
+        return false;
+    m_cacheValid[cascade] = true;
+    m_cachedLightMatrices[cascade] = m_lightMatrices[cascade];
+    glBindFramebuffer(GL_FRAMEBUFFER, m_cacheFBO);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_cacheTexture, 0, cascade);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    return true;
+}
+
+void ShadowMap::beginDynamic(const GLuint& cascade) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_cacheFBO);
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_cacheTexture, 0, cascade);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_FBO);
+    glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, cascade);
+    glBlitFramebuffer(0, 0, m_resolution, m_resolution, 0, 0, m_resolution, m_resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+}
+
+void ShadowMap::end(const GLuint& width, const GLuint& height) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+}
+
+void ShadowMap::bind(const GLuint& unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+}
+
+void ShadowMap::setShader(Shader& shader, GLboolean UseShader) {
+    // from clip space to the texture coordinates and depth of the layers, [-1, 1] to [0, 1]
+    glm::mat4 biasMatrix = glm::translate(glm::mat4(1.f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.f), glm::vec3(0.5f));
+    if (UseShader)
+        shader.use();
+    for (GLuint cascade = 0; cascade < SHADOW_CASCADES; cascade++) {
+        std::string name = "shadowMats[" + std::to_string(cascade) + "]";
+        shader.setMatrix4(name.c_str(), biasMatrix * m_lightMatrices[cascade]);
+    }
+}
+
+// Orthographic light matrix of a cascade around the given corners of a slice of the view frustum.
+// The box is fitted around the bounding sphere of the slice, so its size does not change when the camera turns,
+// and it moves by steps of 1/16 of the resolution, so that the shadows do not shimmer when the camera moves and the
+// matrix stays the same between the steps. The box is padded by a step, so the slice always stays inside.
+// planes receives the box in world space, normals inside, and texelSize the world units of a texel
+glm::mat4 ShadowMap::fitCascade(const glm::vec3 corners[8], const glm::vec3& lightDir, Plane planes[6], GLfloat& texelSize) {
+    GLuint snapTexels = glm::max(m_resolution / 16, 1u);
+
+    glm::vec3 center(0.f);
+    for (GLuint i = 0; i < 8; i++)
+        center += corners[i];
+    center /= 8.f;
+    GLfloat radius = 0.f;
+    for (GLuint i = 0; i < 8; i++)
+        radius = glm::max(radius, glm::length(corners[i] - center));
+    radius = ceilf(radius * 16.f) / 16.f; // no float noise in the size from one frame to the next
+
+    // light space with a fixed origin, in which the center moves by whole steps, depth included
+    GLfloat halfSize = radius / (1.f - 2.f * snapTexels / m_resolution);
+    texelSize = 2.f * halfSize / m_resolution;
+    GLfloat step = texelSize * snapTexels;
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.f), -lightDir, glm::vec3(0.f, 1.f, 0.f));
+    glm::vec3 lightCenter = glm::floor(glm::vec3(lightView * glm::vec4(center, 1.f)) / step) * step;
+    glm::mat4 lightProjection = glm::ortho(lightCenter.x - halfSize, lightCenter.x + halfSize, lightCenter.y - halfSize, lightCenter.y + halfSize,
+        -lightCenter.z - halfSize - SHADOW_CASTER_DISTANCE, -lightCenter.z + halfSize);
+
+    glm::mat4 lightMatrix = lightProjection * lightView;
+    ExtractFrustumPlanes(lightMatrix, planes);
+    return lightMatrix;
+}
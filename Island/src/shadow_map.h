@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "camera.h"
+#include "shader.h"
+
+// Layers of the shadow map, must match shadow.glsl
+const GLuint SHADOW_CASCADES = 3;
+// Smallest resolution of the layers, the cascades move by steps of resolution / 16 texels
+const GLuint SHADOW_RESOLUTION_MIN = 16;
+
+enum ShadowDepthFormat {
+    SHADOW_DEPTH_16,
+    SHADOW_DEPTH_24,
+    SHADOW_DEPTH_32F
+};
+
+/* Cascaded shadow map: one layer of a depth array texture per cascade, each one fitted around a slice of the view
+frustum, the nearest ones being the smallest and sharpest. The layers are read by shadow.glsl with hardware PCF.
+The static casters (terrain, houses) are rendered into a second array, the cache, only when their cascade moves,
+which it does by steps of 1/16 of the resolution, or when invalidate() says they changed. They must be drawn the
+same whatever the camera, e.g. the terrain at a LOD fitting getTexelSize(). Every frame, the cache is copied into
+the shadow map and the dynamic casters (trees) are drawn over it:
+    shadowMap.update(camera, lightDir);
+    shadowMap.begin();
+    for each cascade:
+        if (shadowMap.beginStatic(cascade)) draw the static casters with getLightMatrix(cascade)
+        shadowMap.beginDynamic(cascade); draw the dynamic casters
+    shadowMap.end(width, height); */
+class ShadowMap {
+public:
+    // nearDistance, distance: range of the view covered by the cascades,
+    // splitLambda: 0 for slices of equal length, 1 for logarithmic slices
+    ShadowMap(const GLuint& resolution, const ShadowDepthFormat& format, const GLfloat& nearDistance, const GLfloat& distance,
+        const GLfloat& splitLambda);
+    ~ShadowMap();
+    ShadowMap(const ShadowMap&) = delete;
+    ShadowMap& operator=(const ShadowMap&) = delete;
+    // Both reallocate the layers, the static casters are rendered again on the next frame.
+    // The resolution is raised to SHADOW_RESOLUTION_MIN
+    void setResolution(const GLuint& resolution);
+    void setDepthFormat(const ShadowDepthFormat& format);
+    GLuint getResolution() { return m_resolution; }
+    ShadowDepthFormat getDepthFormat() { return m_format; }
+    // Fits every cascade around its slice of the view of camera, lightDir points toward the light
+    void update(Camera& camera, const glm::vec3& lightDir);
+    // world space to the clip space of the cascade, to render its casters with
+    const glm::mat4& getLightMatrix(const GLuint& cascade) { return m_lightMatrices[cascade]; }
+    // volume of the cascade in world space, normals inside, to cull its casters with
+    const Plane* getFrustum(const GLuint& cascade) { return m_frustums[cascade]; }
+    // world units covered by a texel of the cascade, the detail its casters need
+    GLfloat getTexelSize(const GLuint& cascade) { return m_texelSizes[cascade]; }
+    // The static casters changed (terrain edits, other terrain mode...): every cascade renders them again
+    void invalidate();
+    // Sets the viewport to the layers
+    void begin();
+    // Returns true when the static casters of cascade have to be rendered again, then with its cache layer bound and cleared
+    bool beginStatic(const GLuint& cascade);
+    // Copies the cache of cascade into its layer of the shadow map and binds it for the dynamic casters
+    void beginDynamic(const GLuint& cascade);
+    // Back to the default framebuffer, with a viewport of width x height
+    void end(const GLuint& width, const GLuint& height);
+    void bind(const GLuint& unit);
+    // Sets shadowMats of shadow.glsl. The cascades move in update(), so call it after each update()
+    void setShader(Shader& shader, GLboolean UseShader);
+private:
+    GLuint m_resolution;
+    ShadowDepthFormat m_format;
+    GLfloat m_splits[SHADOW_CASCADES + 1]; // view distances of the slices
+    GLuint m_FBO = 0, m_cacheFBO = 0;
+    GLuint m_texture = 0, m_cacheTexture = 0;
+    glm::mat4 m_lightMatrices[SHADOW_CASCADES];
+    Plane m_frustums[SHADOW_CASCADES][6];
+    GLfloat m_texelSizes[SHADOW_CASCADES] = {};
+    // light matrix each layer of the cache was rendered with
+    glm::mat4 m_cachedLightMatrices[SHADOW_CASCADES];
+    bool m_cacheValid[SHADOW_CASCADES] = {};
+
+    void allocate();
+    void release();
+    glm::mat4 fitCascade(const glm::vec3 corners[8], const glm::vec3& lightDir, Plane planes[6], GLfloat& texelSize);
+};
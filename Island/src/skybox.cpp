@@ -118,6 +118,7 @@ void Skybox::render(const glm::mat4& view, const glm::mat4& projection, const fl
 	m_shaderSkybox->setMatrix4("view", glm::mat4(glm::mat3(view)));
 
 	m_shaderSkybox->setFloat("coeDiurnal", coeDiurnal);
+	m_coeDiurnal = coeDiurnal;
 
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, m_diurnalTexID);
@@ -130,6 +131,13 @@ void Skybox::render(const glm::mat4& view, const glm::mat4& projection, const fl
 	glDepthFunc(GL_LESS);
 }
 
+void Skybox::bindTextures(const GLuint& diurnalUnit, const GLuint& nocturnalUnit) {
+	glActiveTexture(GL_TEXTURE0 + diurnalUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_diurnalTexID);
+	glActiveTexture(GL_TEXTURE0 + nocturnalUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_nocturnalTexID);
+}
+
 void Skybox::loadSkybox(
 	std::string right,
 	std::string left,
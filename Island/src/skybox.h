@@ -27,10 +27,15 @@ public:
 		std::string front
 	);
 	void render(const glm::mat4& view, const glm::mat4& projection, const float& coeDiurnal);
+	// Binds both cube maps, for the shaders that sample the sky themselves (SSR fallback of water.fs)
+	void bindTextures(const GLuint& diurnalUnit, const GLuint& nocturnalUnit);
+	// coeDiurnal of the last render()
+	float getCoeDiurnal() { return m_coeDiurnal; }
 
 private:
 	GLuint m_VAO, m_VBO;
 	GLuint m_diurnalTexID, m_nocturnalTexID;
+	float m_coeDiurnal = 1.f;
 	Shader* m_shaderSkybox;
 
 	void loadSkybox(
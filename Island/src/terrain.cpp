@@ -1,221 +1,1387 @@
+#include <limits>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstddef>
+
 #include <SOIL.h>
 
 #include "terrain.h"
+#include "camera.h"
+#include "mapped_file.h"
+
+#if defined(TERRAIN_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static GLdouble elapsedMilliseconds(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<GLdouble, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+#ifdef TERRAIN_AVX2
+// AVX2 instructions, and the OS saving the 256-bit registers
+static bool cpuHasAVX2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
 
 
 Terrain::~Terrain()
 {
+    if (m_VAO == 0) // never uploaded, e.g. generate() only
+        return;
     glDeleteVertexArrays(1, &m_VAO);
     glDeleteBuffers(1, &m_EBO);
     glDeleteBuffers(1, &m_VBO);
+    if (m_heightTexture != 0)
+        glDeleteTextures(1, &m_heightTexture);
+}
+
+void Terrain::loadClipmap(const GLuint& levelCount, const GLfloat& spacing, const GLfloat& heightMin, const GLfloat& heightRange,
+    const GLfloat& textureScale, const TerrainHeightSource& source) {
+    m_clipmap.reset(new TerrainClipmap(levelCount, spacing, heightMin, heightRange, textureScale, source));
+    m_size = glm::vec2(m_clipmap->getExtent());
+    m_revision++;
 }
 
 void Terrain::load(const glm::vec2& size, const float& heightScale, const float& textureScale, std::string HeightMapLoc) {
-    unsigned char* heightMap = SOIL_load_image(HeightMapLoc.c_str(), &m_cols, &m_rows, 0, SOIL_LOAD_L);
+    m_revision++;
+    m_loadTimes = TerrainLoadTimes();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::ifstream file(HeightMapLoc, std::ios::binary);
+    std::vector<unsigned char> fileData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (fileData.empty()) {
+        std::cout << "ERROR::TERRAIN: Failed to read heightmap " << HeightMapLoc << std::endl;
+        return;
+    }
+
+    // the cache is only valid for the exact same heightmap and parameters
+    TerrainCacheHeader key = {};
+    memcpy(key.Magic, "TRNC", 4);
+    key.Version = TERRAIN_CACHE_VERSION;
+    key.Hash = hashBytes(&fileData[0], fileData.size());
+    key.Size = size;
+    key.HeightScale = heightScale;
+    key.TextureScale = textureScale;
+    key.ChunkSize = TERRAIN_CHUNK_SIZE;
+    key.LodCount = TERRAIN_LOD_COUNT;
+    key.VertexFormat = m_vertexFormat;
+    key.VertexSize = vertexSize();
+    std::string cachePath = HeightMapLoc + ".cache";
+    m_loadTimes.Decode = elapsedMilliseconds(start);
+    if (m_useCache && loadCache(cachePath, key)) {
+        std::cout << "Terrain " << m_cols << "x" << m_rows << " loaded from cache in " << m_loadTimes.total()
+            << " ms (hash " << m_loadTimes.Decode << " ms, read " << m_loadTimes.Cache << " ms, upload " << m_loadTimes.Upload
+            << " ms), vertex buffer " << getVertexBufferSize() / 1024 << " KB" << std::endl;
+        return;
+    }
+
+    start = std::chrono::steady_clock::now();
+    int cols, rows;
+    unsigned char* heightMap = SOIL_load_image_from_memory(&fileData[0], fileData.size(), &cols, &rows, 0, SOIL_LOAD_L);
+    if (!heightMap) {
+        std::cout << "ERROR::TERRAIN: Failed to decode heightmap " << HeightMapLoc << std::endl;
+        return;
+    }
+    m_loadTimes.Decode += elapsedMilliseconds(start);
+    generate(size, heightScale, textureScale, cols, rows, heightMap);
+    SOIL_free_image_data(heightMap);
+
+    if (m_useCache)
+        saveCache(cachePath, key);
+
+    start = std::chrono::steady_clock::now();
+    bufferUpdate(NULL);
+    m_loadTimes.Upload = elapsedMilliseconds(start);
+
+    std::cout << "Terrain " << m_cols << "x" << m_rows << " loaded in " << m_loadTimes.total() << " ms ("
+        << m_pool->size() << " threads, " << (m_simdNormals ? "SIMD" : "scalar") << " normals)" << std::endl;
+    std::cout << "    decode " << m_loadTimes.Decode << " ms, vertices " << m_loadTimes.Vertices
+        << " ms, face normals " << m_loadTimes.FaceNormals << " ms, vertex normals " << m_loadTimes.VertexNormals
+        << " ms, chunks " << m_loadTimes.Chunks << " ms, pack " << m_loadTimes.Pack << " ms, cache " << m_loadTimes.Cache
+        << " ms, upload " << m_loadTimes.Upload << " ms" << std::endl;
+    std::cout << "    vertex buffer " << getVertexBufferSize() / 1024 << " KB (" << vertexSize() << " bytes per vertex)" << std::endl;
+}
+
+void Terrain::generate(const glm::vec2& size, const float& heightScale, const float& textureScale,
+    const int& cols, const int& rows, unsigned char* heightMap) {
+    m_cols = cols;
+    m_rows = rows;
+    m_gridScale = glm::vec2((cols - 1) / size.x, (rows - 1) / size.y);
+    m_textureScale = textureScale;
     generateMesh(size, heightScale, textureScale, m_cols, m_rows, heightMap);
-    bufferUpdate();
+    generateChunks();
+    buildHeightPyramid();
+    if (m_vertexFormat == TERRAIN_VERTEX_PACKED)
+        packVertices();
+    if (m_vertexFormat == TERRAIN_VERTEX_HEIGHT_TEXTURE) {
+        // leaves room for edits up to heightScale
+        m_heightMin = 0.f;
+        m_heightRange = heightScale;
+    }
+}
+
+void Terrain::setShader(Shader& shader, std::string Name, GLboolean UseShader) {
+    if (m_clipmap) {
+        m_clipmap->setShader(shader, Name, UseShader);
+        return;
+    }
+    if (UseShader)
+        shader.use();
+    shader.setInteger((Name + ".vertexFormat").c_str(), m_vertexFormat);
+    shader.setVector2f((Name + ".size").c_str(), m_size);
+    shader.setInteger((Name + ".cols").c_str(), m_cols);
+    shader.setInteger((Name + ".rows").c_str(), m_rows);
+    shader.setInteger((Name + ".chunksX").c_str(), m_chunksX);
+    shader.setFloat((Name + ".textureScale").c_str(), m_textureScale);
+    shader.setFloat((Name + ".heightMin").c_str(), m_heightMin);
+    shader.setFloat((Name + ".heightRange").c_str(), m_heightRange);
+    shader.setFloat((Name + ".skirtDepth").c_str(), m_skirtDepth);
+    shader.setInteger("terrainHeights", TERRAIN_HEIGHT_TEXTURE_UNIT);
+    for (const std::pair<Shader, std::string>& set : m_shaders) {
+        if (set.first.ID == shader.ID && set.second == Name)
+            return;
+    }
+    m_shaders.push_back(std::make_pair(shader, Name));
+}
+
+void Terrain::setHeights(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols, const GLfloat* heights) {
+    if (!checkRegion(row0, col0, rows, cols))
+        return;
+    for (GLuint i = 0; i < rows; i++)
+        memcpy(&m_heights[(row0 + i) * m_cols + col0], &heights[i * cols], cols * sizeof(GLfloat));
+    updateRegion(row0, col0, rows, cols);
+}
+
+void Terrain::addHeights(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols, const GLfloat* deltas) {
+    if (!checkRegion(row0, col0, rows, cols))
+        return;
+    for (GLuint i = 0; i < rows; i++)
+        for (GLuint j = 0; j < cols; j++)
+            m_heights[(row0 + i) * m_cols + col0 + j] += deltas[i * cols + j];
+    updateRegion(row0, col0, rows, cols);
+}
+
+bool Terrain::checkRegion(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols) {
+    if (m_clipmap || m_VAO == 0) {
+        std::cout << "ERROR::TERRAIN: Heights can only be edited after load()" << std::endl;
+        return false;
+    }
+    if (rows == 0 || cols == 0 || row0 + rows > (GLuint)m_rows || col0 + cols > (GLuint)m_cols) {
+        std::cout << "ERROR::TERRAIN: Height rectangle outside of the heightmap" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Refreshes everything that depends on the given heights: the normals of the vertices around them,
+// the chunks holding these vertices and the GPU copy
+void Terrain::updateRegion(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols) {
+    // vertex normals read the faces around them, so they change one cell beyond the rectangle
+    GLuint firstRow = row0 > 0 ? row0 - 1 : 0, firstCol = col0 > 0 ? col0 - 1 : 0;
+    GLuint lastRow = glm::min(row0 + rows, m_rows - 1u), lastCol = glm::min(col0 + cols, m_cols - 1u);
+    // chunks share their border vertices, so a vertex can belong to up to 4 chunks
+    const GLuint N = TERRAIN_CHUNK_SIZE;
+    GLuint chunkX0 = firstCol > 0 ? (firstCol - 1) / N : 0, chunkZ0 = firstRow > 0 ? (firstRow - 1) / N : 0;
+    GLuint chunkX1 = glm::min(lastCol / N, m_chunksX - 1), chunkZ1 = glm::min(lastRow / N, m_chunksZ - 1);
+    for (GLuint cz = chunkZ0; cz <= chunkZ1; cz++)
+        for (GLuint cx = chunkX0; cx <= chunkX1; cx++)
+            updateChunk(cz * m_chunksX + cx);
+    GLfloat skirtDepth = m_skirtDepth;
+    updateSkirtDepth();
+    if (m_skirtDepth != skirtDepth)
+        uploadSkirtDepth();
+    updateNodeBounds();
+    updateHeightPyramid(firstRow, firstCol, lastRow, lastCol);
+    m_revision++;
+
+    if (m_vertexFormat == TERRAIN_VERTEX_HEIGHT_TEXTURE) {
+        uploadHeights(row0, col0, rows, cols);
+        return;
+    }
+    for (GLuint cz = chunkZ0; cz <= chunkZ1; cz++)
+        for (GLuint cx = chunkX0; cx <= chunkX1; cx++)
+            uploadChunkRows(cz * m_chunksX + cx, firstRow, lastRow);
+}
+
+// Rebuilds the vertices of a chunk between the grid rows firstRow and lastRow, and its skirts whose depth may have changed,
+// then pushes both ranges with glBufferSubData
+void Terrain::uploadChunkRows(const GLuint& chunkIndex, const GLuint& firstRow, const GLuint& lastRow) {
+    const GLuint N = TERRAIN_CHUNK_SIZE;
+    const TerrainChunk& chunk = m_chunks[chunkIndex];
+    GLuint row0 = chunkIndex / m_chunksX * N, col0 = chunkIndex % m_chunksX * N;
+    // local rows of the chunk, whole rows so that the range is contiguous
+    GLuint first = firstRow > row0 ? firstRow - row0 : 0;
+    GLuint last = glm::min(lastRow - row0, N);
+    GLuint gridCount = (last - first + 1) * (N + 1);
+    GLuint skirtCount = 4 * (N + 1);
+
+    std::vector<glm::vec3> positions(gridCount + skirtCount);
+    std::vector<glm::vec3> normals(gridCount + skirtCount);
+    for (GLuint i = first; i <= last; i++) {
+        for (GLuint j = 0; j <= N; j++) {
+            GLuint local = (i - first) * (N + 1) + j;
+            positions[local] = gridPosition(row0 + i, col0 + j);
+            normals[local] = gridNormal(row0 + i, col0 + j);
+        }
+    }
+    for (GLuint e = 0; e < 4; e++) {
+        for (GLuint k = 0; k <= N; k++) {
+            GLuint edge = skirtEdgeIndex(e, k);
+            GLuint row = row0 + edge / (N + 1), col = col0 + edge % (N + 1);
+            GLuint local = gridCount + e * (N + 1) + k;
+            positions[local] = gridPosition(row, col) - glm::vec3(0.f, glm::max(chunk.SkirtDepth, m_skirtDepth), 0.f);
+            normals[local] = gridNormal(row, col);
+        }
+    }
+
+    GLintptr gridVertex = chunk.BaseVertex + first * (N + 1);
+    GLintptr skirtVertex = chunk.BaseVertex + (N + 1) * (N + 1);
+    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+    if (m_vertexFormat == TERRAIN_VERTEX_PACKED) {
+        std::vector<TerrainPackedVertex> packed(positions.size());
+        for (GLuint i = 0; i < positions.size(); i++)
+            packed[i] = packVertex(positions[i].y, normals[i]);
+        glBufferSubData(GL_ARRAY_BUFFER, gridVertex * sizeof(TerrainPackedVertex), gridCount * sizeof(TerrainPackedVertex), &packed[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, skirtVertex * sizeof(TerrainPackedVertex), skirtCount * sizeof(TerrainPackedVertex), &packed[gridCount]);
+    }
+    else {
+        // positions and normals blocks, the texcoords do not change
+        GLintptr normalBlock = (GLintptr)m_vertexCount * (sizeof(glm::vec3) + sizeof(glm::vec2));
+        glBufferSubData(GL_ARRAY_BUFFER, gridVertex * sizeof(glm::vec3), gridCount * sizeof(glm::vec3), &positions[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, skirtVertex * sizeof(glm::vec3), skirtCount * sizeof(glm::vec3), &positions[gridCount]);
+        glBufferSubData(GL_ARRAY_BUFFER, normalBlock + gridVertex * sizeof(glm::vec3), gridCount * sizeof(glm::vec3), &normals[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, normalBlock + skirtVertex * sizeof(glm::vec3), skirtCount * sizeof(glm::vec3), &normals[gridCount]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Position of a grid vertex, as generateMesh() computes it. Rows and columns past the heightmap are clamped like gridIndex()
+glm::vec3 Terrain::gridPosition(const GLuint& row, const GLuint& col) {
+    GLuint i = glm::min(row, m_rows - 1u), j = glm::min(col, m_cols - 1u);
+    return glm::vec3((j / (m_cols - 1.f) - 0.5f) * m_size.x, m_heights[i * m_cols + j], (i / (m_rows - 1.f) - 0.5f) * m_size.y);
+}
+
+// Smooth normal of a grid vertex from the faces around it, same as the scalar path of generateMesh()
+glm::vec3 Terrain::gridNormal(const GLuint& row, const GLuint& col) {
+    GLint i = glm::min(row, m_rows - 1u), j = glm::min(col, m_cols - 1u);
+    glm::vec3 sum = glm::vec3(0.f);
+    // faces (i, j) of the upper (0) and lower (1) triangles touching the vertex, as in generateMesh()
+    const GLint faces[6][3] = { { -1, -1, 1 }, { -1, 0, 0 }, { -1, 0, 1 }, { 0, 0, 0 }, { 0, -1, 0 }, { 0, -1, 1 } };
+    for (const GLint* face : faces) {
+        GLint fi = i + face[0], fj = j + face[1];
+        if (fi < 0 || fj < 0 || fi >= m_rows - 1 || fj >= m_cols - 1)
+            continue;
+        glm::vec3 a, b, c;
+        if (face[2] == 0) {
+            a = gridPosition(fi, fj);
+            b = gridPosition(fi + 1, fj);
+            c = gridPosition(fi, fj + 1);
+        }
+        else {
+            a = gridPosition(fi, fj + 1);
+            b = gridPosition(fi + 1, fj);
+            c = gridPosition(fi + 1, fj + 1);
+        }
+        sum += glm::normalize(glm::cross(a - c, b - c));
+    }
+    return glm::normalize(sum);
+}
+
+// Copies a rectangle of m_heights to the height texture, normalized over the height range
+void Terrain::uploadHeights(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols) {
+    std::vector<GLushort> texels(rows * cols);
+    for (GLuint i = 0; i < rows; i++) {
+        for (GLuint j = 0; j < cols; j++) {
+            GLfloat height = (m_heights[(row0 + i) * m_cols + col0 + j] - m_heightMin) / m_heightRange;
+            texels[i * cols + j] = (GLushort)glm::round(glm::clamp(height, 0.f, 1.f) * 65535.f);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, m_heightTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, col0, row0, cols, rows, GL_RED, GL_UNSIGNED_SHORT, &texels[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Terrain::update(Camera& camera, const GLfloat& viewportHeight) {
+    if (m_clipmap) {
+        if (m_clipmap->update(camera.Position))
+            m_revision++;
+        return;
+    }
+    // size in pixels of one world unit seen at distance 1, i.e. viewportHeight / (2 * tan(fov / 2))
+    GLfloat pixelsPerUnit = viewportHeight * camera.Near / camera.NearHeight;
+    for (TerrainChunk& chunk : m_chunks) {
+        glm::vec3 closest = glm::clamp(camera.Position, chunk.BoundsMin, chunk.BoundsMax);
+        GLfloat distance = glm::max(glm::length(camera.Position - closest), camera.Near);
+        // take the coarsest LOD whose projected error is still acceptable
+        chunk.Lod = 0;
+        for (GLuint lod = TERRAIN_LOD_COUNT - 1; lod > 0; lod--) {
+            if (chunk.LodError[lod] * pixelsPerUnit / distance <= m_pixelError) {
+                chunk.Lod = lod;
+                break;
+            }
+        }
+    }
 }
 
 void Terrain::render() {
+    if (m_clipmap) {
+        m_clipmap->render();
+        return;
+    }
+    m_drawCounts.clear();
+    m_drawOffsets.clear();
+    m_drawBaseVertices.clear();
+    for (const TerrainChunk& chunk : m_chunks)
+        pushDraw(chunk);
+    draw();
+}
+
+void Terrain::render(const Plane* frustum, const GLuint& planeCount) {
+    if (m_clipmap) {
+        m_clipmap->render();
+        return;
+    }
+    m_drawCounts.clear();
+    m_drawOffsets.clear();
+    m_drawBaseVertices.clear();
+    cullNode(m_root, frustum, planeCount, (1u << planeCount) - 1);
+    draw();
+}
+
+void Terrain::renderFixedLod(const Plane* frustum, const GLuint& planeCount, const GLfloat& maxError) {
+    m_fixedLodError = maxError;
+    render(frustum, planeCount);
+    m_fixedLodError = -1.f;
+}
+
+void Terrain::cullNode(const GLint& index, const Plane* frustum, const GLuint& planeCount, GLuint planeMask) {
+    const TerrainNode& node = m_nodes[index];
+    for (GLuint i = 0; i < planeCount; i++) {
+        if (!(planeMask & (1u << i)))
+            continue;
+        // corners of the box which are the farthest along / against the plane normal
+        const Plane& plane = frustum[i];
+        glm::vec3 positive = glm::vec3(plane.Normal.x >= 0.f ? node.BoundsMax.x : node.BoundsMin.x,
+            plane.Normal.y >= 0.f ? node.BoundsMax.y : node.BoundsMin.y,
+            plane.Normal.z >= 0.f ? node.BoundsMax.z : node.BoundsMin.z);
+        glm::vec3 negative = glm::vec3(plane.Normal.x >= 0.f ? node.BoundsMin.x : node.BoundsMax.x,
+            plane.Normal.y >= 0.f ? node.BoundsMin.y : node.BoundsMax.y,
+            plane.Normal.z >= 0.f ? node.BoundsMin.z : node.BoundsMax.z);
+        if (plane.Distance(positive) < 0.f) // box is completely outside
+            return;
+        if (plane.Distance(negative) >= 0.f) // box is completely inside, no need to test the children against this plane
+            planeMask &= ~(1u << i);
+    }
+
+    if (node.Chunk >= 0) {
+        pushDraw(m_chunks[node.Chunk]);
+        return;
+    }
+    for (GLuint i = 0; i < 4; i++) {
+        if (node.Children[i] >= 0)
+            cullNode(node.Children[i], frustum, planeCount, planeMask);
+    }
+}
+
+void Terrain::pushDraw(const TerrainChunk& chunk) {
+    GLuint lod = chunk.Lod;
+    if (m_fixedLodError >= 0.f) {
+        lod = 0;
+        for (GLuint coarser = TERRAIN_LOD_COUNT - 1; coarser > 0; coarser--) {
+            if (chunk.LodError[coarser] <= m_fixedLodError) {
+                lod = coarser;
+                break;
+            }
+        }
+    }
+    m_drawCounts.push_back(m_lodIndexCount[lod]);
+    m_drawOffsets.push_back((const void*)(m_lodIndexOffset[lod] * sizeof(GLushort)));
+    m_drawBaseVertices.push_back(chunk.BaseVertex);
+}
+
+void Terrain::draw() {
+    if (m_drawCounts.empty())
+        return;
+    if (m_heightTexture != 0) {
+        glActiveTexture(GL_TEXTURE0 + TERRAIN_HEIGHT_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, m_heightTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
     glBindVertexArray(m_VAO);
-    glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, 0);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &m_drawCounts[0], GL_UNSIGNED_SHORT, &m_drawOffsets[0], m_drawCounts.size(), &m_drawBaseVertices[0]);
     glBindVertexArray(0);
 }
 
 float Terrain::getHeight(const float& worldX, const float& worldZ) {
-    // ԭϵ
-    GLfloat terrainX = worldX + 0.5 * m_size.x;
-    GLfloat terrainZ = worldZ + 0.5 * m_size.y;
-    GLfloat gridSquareSizeX = m_size.x / (m_cols - 1);
-    GLfloat gridSquareSizeZ = m_size.y / (m_rows - 1);
-    GLuint gridX = terrainX / gridSquareSizeX;
-    GLuint gridZ = terrainZ / gridSquareSizeZ;
+    if (m_clipmap)
+        return m_clipmap->getHeight(worldX, worldZ);
+    // ԭϵ, in cells
+    GLfloat gridX = (worldX + 0.5f * m_size.x) * m_gridScale.x;
+    GLfloat gridZ = (worldZ + 0.5f * m_size.y) * m_gridScale.y;
 
     // boundary check
-    if (gridX > (m_cols - 1) || gridZ > (m_rows - 1) || gridX < 0.f || gridZ < 0.f)
+    if (!(gridX >= 0.f && gridX <= m_cols - 1 && gridZ >= 0.f && gridZ <= m_rows - 1))
         return 0.f;
 
-    // ͨƫ
-    GLfloat xCoordSquare = fmod(terrainX, gridSquareSizeX) / gridSquareSizeX;
-    GLfloat zCoordSquare = fmod(terrainZ, gridSquareSizeZ) / gridSquareSizeZ;
-    GLfloat height = 0.0f;
+    // the last row and column of vertices belong to the cells before them
+    GLfloat cellX = glm::min((GLfloat)(GLint)gridX, m_cols - 2.f);
+    GLfloat cellZ = glm::min((GLfloat)(GLint)gridZ, m_rows - 2.f);
+    GLfloat xCoordSquare = gridX - cellX;
+    GLfloat zCoordSquare = gridZ - cellZ;
+    const GLfloat* cell = &m_heights[(GLuint)cellZ * m_cols + (GLuint)cellX];
 
     /*
      z
     
      --------x
     */
-    if (xCoordSquare <= 1 - zCoordSquare) // Left triangle // might be zCoordSquare, check here if it goes wrong
-    {
-        height = barryCentric(glm::vec3(0, m_vertices[gridZ][gridX].y, 0),
-            glm::vec3(1, m_vertices[gridZ][gridX + 1].y, 0),
-            glm::vec3(0, m_vertices[gridZ + 1][gridX].y, 1),
-            glm::vec2(xCoordSquare, zCoordSquare)
-        );
-    }
+    // ֵ߶, written as in getHeightsSSE() / getHeightsAVX2() so that the results are the same
+    if (xCoordSquare <= 1 - zCoordSquare) // Left triangle
+        return cell[0] + xCoordSquare * (cell[1] - cell[0]) + zCoordSquare * (cell[m_cols] - cell[0]);
     else // Right triangle
-    {
-        height = barryCentric(glm::vec3(1, m_vertices[gridZ][gridX + 1].y, 0),
-            glm::vec3(1, m_vertices[gridZ + 1][gridX + 1].y, 1),
-            glm::vec3(0, m_vertices[gridZ + 1][gridX].y, 1),
-            glm::vec2(xCoordSquare, zCoordSquare)
-        );
+        return cell[m_cols + 1] + (1 - xCoordSquare) * (cell[m_cols] - cell[m_cols + 1]) + (1 - zCoordSquare) * (cell[1] - cell[m_cols + 1]);
+}
+
+void Terrain::getHeights(const glm::vec2* positions, GLfloat* heights, const GLuint& count) {
+    GLuint i = 0;
+    if (m_clipmap) {
+        for (; i < count; i++)
+            heights[i] = m_clipmap->getHeight(positions[i].x, positions[i].y);
+        return;
+    }
+#ifdef TERRAIN_AVX2
+    static const bool avx2 = cpuHasAVX2();
+    if (avx2) {
+        for (; i + 8 <= count; i += 8)
+            getHeightsAVX2(&positions[i], &heights[i]);
+    }
+#endif
+#ifdef TERRAIN_SSE
+    for (; i + 4 <= count; i += 4)
+        getHeightsSSE(&positions[i], &heights[i]);
+#endif
+    for (; i < count; i++)
+        heights[i] = getHeight(positions[i].x, positions[i].y);
+}
+
+bool Terrain::raycast(const glm::vec3& origin, const glm::vec3& direction, const GLfloat& maxDistance, glm::vec3& hit, GLfloat* distance) {
+    if (m_clipmap || m_pyramidSize.empty())
+        return false;
+    glm::vec3 dir = glm::normalize(direction);
+    // axis-aligned rays would give 0 * infinity in the slab test
+    glm::vec3 invDir;
+    for (GLuint k = 0; k < 3; k++)
+        invDir[k] = 1.f / (glm::abs(dir[k]) > 1e-20f ? dir[k] : 1e-20f);
+    GLfloat best = maxDistance;
+    bool found = false;
+
+    // nodes are (level, column, row) of the pyramid, visited front to back so that most of them are pruned once a hit is found
+    struct PyramidNode { GLuint Level, Col, Row; GLfloat Near; };
+    PyramidNode stack[64 * 4];
+    GLuint top = 0;
+    stack[top++] = { (GLuint)m_pyramidSize.size() - 1, 0, 0, 0.f };
+    while (top > 0) {
+        PyramidNode node = stack[--top];
+        if (node.Near > best)
+            continue;
+        if (node.Level == 0) {
+            // the two triangles of the cell, same as the mesh
+            GLuint i = node.Row, j = node.Col;
+            glm::vec3 corners[2][3] = {
+                { gridPosition(i, j), gridPosition(i + 1, j), gridPosition(i, j + 1) },
+                { gridPosition(i, j + 1), gridPosition(i + 1, j), gridPosition(i + 1, j + 1) }
+            };
+            for (const glm::vec3* triangle : corners) {
+                // Moller-Trumbore, both sides
+                glm::vec3 edge1 = triangle[1] - triangle[0], edge2 = triangle[2] - triangle[0];
+                glm::vec3 p = glm::cross(dir, edge2);
+                GLfloat det = glm::dot(edge1, p);
+                if (glm::abs(det) < 1e-12f)
+                    continue;
+                glm::vec3 q = origin - triangle[0];
+                GLfloat u = glm::dot(q, p) / det;
+                glm::vec3 r = glm::cross(q, edge1);
+                GLfloat v = glm::dot(dir, r) / det;
+                GLfloat t = glm::dot(edge2, r) / det;
+                if (u >= 0.f && v >= 0.f && u + v <= 1.f && t >= 0.f && t <= best) {
+                    best = t;
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        // children entered by the ray, pushed farthest first
+        PyramidNode children[4];
+        GLuint childCount = 0;
+        GLuint level = node.Level - 1;
+        for (GLuint k = 0; k < 4; k++) {
+            GLuint col = node.Col * 2 + (k & 1), row = node.Row * 2 + (k >> 1);
+            if (col >= m_pyramidSize[level].x || row >= m_pyramidSize[level].y)
+                continue;
+            GLuint index = m_pyramidOffset[level] + row * m_pyramidSize[level].x + col;
+            GLuint col1 = glm::min((col + 1) << level, m_cols - 1u), row1 = glm::min((row + 1) << level, m_rows - 1u);
+            glm::vec3 boundsMin = glm::vec3(((col << level) / (m_cols - 1.f) - 0.5f) * m_size.x, m_pyramidMin[index], ((row << level) / (m_rows - 1.f) - 0.5f) * m_size.y);
+            glm::vec3 boundsMax = glm::vec3((col1 / (m_cols - 1.f) - 0.5f) * m_size.x, m_pyramidMax[index], (row1 / (m_rows - 1.f) - 0.5f) * m_size.y);
+            glm::vec3 t0 = (boundsMin - origin) * invDir, t1 = (boundsMax - origin) * invDir;
+            glm::vec3 tMin = glm::min(t0, t1), tMax = glm::max(t0, t1);
+            GLfloat tNear = glm::max(glm::max(tMin.x, tMin.y), glm::max(tMin.z, 0.f));
+            GLfloat tFar = glm::min(glm::min(tMax.x, tMax.y), glm::min(tMax.z, best));
+            if (tNear > tFar)
+                continue;
+            children[childCount++] = { level, col, row, tNear };
+        }
+        std::sort(children, children + childCount, [](const PyramidNode& a, const PyramidNode& b) { return a.Near > b.Near; });
+        for (GLuint k = 0; k < childCount; k++)
+            stack[top++] = children[k];
+    }
+
+    if (found) {
+        hit = origin + best * dir;
+        if (distance)
+            *distance = best;
+    }
+    return found;
+}
+
+// One min / max entry per cell in level 0, then per 2 x 2 entries of the level below until a single entry is left
+void Terrain::buildHeightPyramid() {
+    m_pyramidOffset.clear();
+    m_pyramidSize.clear();
+    glm::uvec2 size = glm::uvec2(m_cols - 1, m_rows - 1);
+    GLuint total = 0;
+    while (true) {
+        m_pyramidOffset.push_back(total);
+        m_pyramidSize.push_back(size);
+        total += size.x * size.y;
+        if (size.x == 1 && size.y == 1)
+            break;
+        size = (size + 1u) / 2u;
+    }
+    m_pyramidMin.resize(total);
+    m_pyramidMax.resize(total);
+    updateHeightPyramid(0, 0, m_rows - 1, m_cols - 1);
+}
+
+// Refreshes the entries above the vertices between rows firstRow..lastRow and columns firstCol..lastCol
+void Terrain::updateHeightPyramid(const GLuint& firstRow, const GLuint& firstCol, const GLuint& lastRow, const GLuint& lastCol) {
+    // cells touching these vertices
+    GLuint row0 = firstRow > 0 ? firstRow - 1 : 0, col0 = firstCol > 0 ? firstCol - 1 : 0;
+    GLuint row1 = glm::min(lastRow, m_rows - 2u), col1 = glm::min(lastCol, m_cols - 2u);
+    for (GLuint i = row0; i <= row1; i++) {
+        for (GLuint j = col0; j <= col1; j++) {
+            const GLfloat* cell = &m_heights[i * m_cols + j];
+            GLuint index = i * m_pyramidSize[0].x + j;
+            m_pyramidMin[index] = glm::min(glm::min(cell[0], cell[1]), glm::min(cell[m_cols], cell[m_cols + 1]));
+            m_pyramidMax[index] = glm::max(glm::max(cell[0], cell[1]), glm::max(cell[m_cols], cell[m_cols + 1]));
+        }
+    }
+    for (GLuint level = 1; level < m_pyramidSize.size(); level++) {
+        row0 /= 2; col0 /= 2; row1 /= 2; col1 /= 2;
+        glm::uvec2 below = m_pyramidSize[level - 1];
+        for (GLuint i = row0; i <= row1; i++) {
+            for (GLuint j = col0; j <= col1; j++) {
+                GLfloat heightMin = std::numeric_limits<float>::max(), heightMax = -std::numeric_limits<float>::max();
+                for (GLuint k = 0; k < 4; k++) {
+                    GLuint col = j * 2 + (k & 1), row = i * 2 + (k >> 1);
+                    if (col >= below.x || row >= below.y)
+                        continue;
+                    GLuint index = m_pyramidOffset[level - 1] + row * below.x + col;
+                    heightMin = glm::min(heightMin, m_pyramidMin[index]);
+                    heightMax = glm::max(heightMax, m_pyramidMax[index]);
+                }
+                GLuint index = m_pyramidOffset[level] + i * m_pyramidSize[level].x + j;
+                m_pyramidMin[index] = heightMin;
+                m_pyramidMax[index] = heightMax;
+            }
+        }
+    }
+}
+
+#ifdef TERRAIN_SSE
+void Terrain::getHeightsSSE(const glm::vec2* positions, GLfloat* heights) {
+    // (x0, z0, x1, z1), (x2, z2, x3, z3) -> (x0, x1, x2, x3), (z0, z1, z2, z3)
+    __m128 pairs0 = _mm_loadu_ps(&positions[0].x), pairs1 = _mm_loadu_ps(&positions[2].x);
+    __m128 gridX = _mm_shuffle_ps(pairs0, pairs1, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 gridZ = _mm_shuffle_ps(pairs0, pairs1, _MM_SHUFFLE(3, 1, 3, 1));
+    gridX = _mm_mul_ps(_mm_add_ps(gridX, _mm_set1_ps(0.5f * m_size.x)), _mm_set1_ps(m_gridScale.x));
+    gridZ = _mm_mul_ps(_mm_add_ps(gridZ, _mm_set1_ps(0.5f * m_size.y)), _mm_set1_ps(m_gridScale.y));
+
+    // points outside of the terrain get a height of 0, their cell is clamped so that the loads below stay valid
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+    const __m128 maxX = _mm_set1_ps((GLfloat)(m_cols - 1)), maxZ = _mm_set1_ps((GLfloat)(m_rows - 1));
+    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(gridX, zero), _mm_cmple_ps(gridX, maxX)),
+        _mm_and_ps(_mm_cmpge_ps(gridZ, zero), _mm_cmple_ps(gridZ, maxZ)));
+    gridX = _mm_min_ps(_mm_max_ps(gridX, zero), maxX);
+    gridZ = _mm_min_ps(_mm_max_ps(gridZ, zero), maxZ);
+    __m128 cellX = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gridX)), _mm_set1_ps(m_cols - 2.f));
+    __m128 cellZ = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(gridZ)), _mm_set1_ps(m_rows - 2.f));
+    __m128 xCoordSquare = _mm_sub_ps(gridX, cellX);
+    __m128 zCoordSquare = _mm_sub_ps(gridZ, cellZ);
+
+    // SSE has no gather, the 4 corners of each cell are loaded one by one
+    alignas(16) GLint col[4], row[4];
+    alignas(16) GLfloat h00[4], h01[4], h10[4], h11[4];
+    _mm_store_si128((__m128i*)col, _mm_cvttps_epi32(cellX));
+    _mm_store_si128((__m128i*)row, _mm_cvttps_epi32(cellZ));
+    for (GLuint k = 0; k < 4; k++) {
+        const GLfloat* cell = &m_heights[(GLuint)row[k] * m_cols + col[k]];
+        h00[k] = cell[0];
+        h01[k] = cell[1];
+        h10[k] = cell[m_cols];
+        h11[k] = cell[m_cols + 1];
     }
+    __m128 v00 = _mm_load_ps(h00), v01 = _mm_load_ps(h01), v10 = _mm_load_ps(h10), v11 = _mm_load_ps(h11);
+
+    __m128 left = _mm_add_ps(_mm_add_ps(v00, _mm_mul_ps(xCoordSquare, _mm_sub_ps(v01, v00))), _mm_mul_ps(zCoordSquare, _mm_sub_ps(v10, v00)));
+    __m128 right = _mm_add_ps(_mm_add_ps(v11, _mm_mul_ps(_mm_sub_ps(one, xCoordSquare), _mm_sub_ps(v10, v11))),
+        _mm_mul_ps(_mm_sub_ps(one, zCoordSquare), _mm_sub_ps(v01, v11)));
+    __m128 isLeft = _mm_cmple_ps(xCoordSquare, _mm_sub_ps(one, zCoordSquare));
+    __m128 height = _mm_or_ps(_mm_and_ps(isLeft, left), _mm_andnot_ps(isLeft, right));
+    _mm_storeu_ps(heights, _mm_and_ps(height, inside));
+}
+#endif
+
+#ifdef TERRAIN_AVX2
+void Terrain::getHeightsAVX2(const glm::vec2* positions, GLfloat* heights) {
+    // same as getHeightsSSE() on 8 points, the corners are gathered
+    // the in-lane shuffles give (x0, x1, x4, x5, x2, x3, x6, x7), the permutation puts them back in order
+    __m256 pairs0 = _mm256_loadu_ps(&positions[0].x), pairs1 = _mm256_loadu_ps(&positions[4].x);
+    __m256 gridX = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(pairs0, pairs1, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+    __m256 gridZ = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(pairs0, pairs1, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+    gridX = _mm256_mul_ps(_mm256_add_ps(gridX, _mm256_set1_ps(0.5f * m_size.x)), _mm256_set1_ps(m_gridScale.x));
+    gridZ = _mm256_mul_ps(_mm256_add_ps(gridZ, _mm256_set1_ps(0.5f * m_size.y)), _mm256_set1_ps(m_gridScale.y));
 
-    return height;
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+    const __m256 maxX = _mm256_set1_ps((GLfloat)(m_cols - 1)), maxZ = _mm256_set1_ps((GLfloat)(m_rows - 1));
+    __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(gridX, zero, _CMP_GE_OQ), _mm256_cmp_ps(gridX, maxX, _CMP_LE_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(gridZ, zero, _CMP_GE_OQ), _mm256_cmp_ps(gridZ, maxZ, _CMP_LE_OQ)));
+    gridX = _mm256_min_ps(_mm256_max_ps(gridX, zero), maxX);
+    gridZ = _mm256_min_ps(_mm256_max_ps(gridZ, zero), maxZ);
+    __m256 cellX = _mm256_min_ps(_mm256_cvtepi32_ps(_mm256_cvttps_epi32(gridX)), _mm256_set1_ps(m_cols - 2.f));
+    __m256 cellZ = _mm256_min_ps(_mm256_cvtepi32_ps(_mm256_cvttps_epi32(gridZ)), _mm256_set1_ps(m_rows - 2.f));
+    __m256 xCoordSquare = _mm256_sub_ps(gridX, cellX);
+    __m256 zCoordSquare = _mm256_sub_ps(gridZ, cellZ);
+
+    __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(cellZ), _mm256_set1_epi32(m_cols)), _mm256_cvttps_epi32(cellX));
+    __m256i indexBelow = _mm256_add_epi32(index, _mm256_set1_epi32(m_cols));
+    const GLfloat* base = &m_heights[0];
+    __m256 v00 = _mm256_i32gather_ps(base, index, 4);
+    __m256 v01 = _mm256_i32gather_ps(base + 1, index, 4);
+    __m256 v10 = _mm256_i32gather_ps(base, indexBelow, 4);
+    __m256 v11 = _mm256_i32gather_ps(base + 1, indexBelow, 4);
+
+    __m256 left = _mm256_add_ps(_mm256_add_ps(v00, _mm256_mul_ps(xCoordSquare, _mm256_sub_ps(v01, v00))), _mm256_mul_ps(zCoordSquare, _mm256_sub_ps(v10, v00)));
+    __m256 right = _mm256_add_ps(_mm256_add_ps(v11, _mm256_mul_ps(_mm256_sub_ps(one, xCoordSquare), _mm256_sub_ps(v10, v11))),
+        _mm256_mul_ps(_mm256_sub_ps(one, zCoordSquare), _mm256_sub_ps(v01, v11)));
+    __m256 isLeft = _mm256_cmp_ps(xCoordSquare, _mm256_sub_ps(one, zCoordSquare), _CMP_LE_OQ);
+    _mm256_storeu_ps(heights, _mm256_and_ps(_mm256_blendv_ps(right, left, isLeft), inside));
 }
+#endif
 
 void Terrain::generateMesh(const glm::vec2& size, const float& heightScale,
     const float& textureScale, const int& cols, const int& rows, unsigned char* heightMap) {
     m_size = size;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
     /************************** Generate Vertices and TexCoords ************************/
-    m_vertices = std::vector<std::vector<glm::vec3>>(rows, std::vector<glm::vec3>(cols));
-    m_texCoords = std::vector<std::vector<glm::vec2>>(rows, std::vector<glm::vec2>(cols));
-    for (GLuint i = 0; i < rows; i++) {
-        for (GLuint j = 0; j < cols; j++) {
-            float luminance = heightMap[i * cols + j];
-            float height = luminance / 255.f * heightScale;
-            float scaleCol = j / (cols - 1.f) - 0.5f;
-            float scaleRow = i / (rows - 1.f) - 0.5f;
-            m_vertices[i][j] = glm::vec3(scaleCol * size.x, height, scaleRow * size.y);
-            m_texCoords[i][j] = glm::vec2(scaleCol * textureScale, scaleRow * textureScale);
-        }
-    }
-
-    /************************** Generate Indices ************************/
-    // iterate each square, which is formed by 2 triangles
-    for (GLuint i = 0; i < rows - 1; i++) {
-        for (GLuint j = 0; j < cols - 1; j++) {
-            /*
-                0-------------2
-                |           /   0
-                | upper  /   /  |
-                |     /   /     |
-                |  /   /  lower |
-                1   /           |
-                 1--------------2
-            */
-            // upper triangle, in counter clockwise
-            m_indices.push_back(i * cols + j);
-            m_indices.push_back((i + 1) * cols + j);
-            m_indices.push_back(i * cols + j + 1);
-
-            // lower triangle, in counter clockwise
-            m_indices.push_back(i * cols + j + 1);
-            m_indices.push_back((i + 1) * cols + j);
-            m_indices.push_back((i + 1) * cols + j + 1);
+    // all grids are stored row by row, vertex (i, j) is at index i * cols + j
+    m_heights = std::vector<GLfloat>(rows * cols);
+    m_vertices = std::vector<glm::vec3>(rows * cols);
+    m_texCoords = std::vector<glm::vec2>(rows * cols);
+    m_pool->parallelFor(0, rows, [&](GLuint rowBegin, GLuint rowEnd) {
+        for (GLuint i = rowBegin; i < rowEnd; i++) {
+            for (GLuint j = 0; j < cols; j++) {
+                float luminance = heightMap[i * cols + j];
+                float height = luminance / 255.f * heightScale;
+                float scaleCol = j / (cols - 1.f) - 0.5f;
+                float scaleRow = i / (rows - 1.f) - 0.5f;
+                m_heights[i * cols + j] = height;
+                m_vertices[i * cols + j] = glm::vec3(scaleCol * size.x, height, scaleRow * size.y);
+                m_texCoords[i * cols + j] = glm::vec2(scaleCol * textureScale, scaleRow * textureScale);
+            }
         }
-    }
+    });
+    m_loadTimes.Vertices = elapsedMilliseconds(start);
 
     /************************** Generate Normals ************************/
+    // terrain.vs derives them from the height texture
+    if (m_vertexFormat == TERRAIN_VERTEX_HEIGHT_TEXTURE)
+        return;
+    m_normals = std::vector<glm::vec3>(rows * cols);
+#ifdef TERRAIN_SSE
+    if (m_simdNormals) {
+        generateNormalsSSE(cols, rows);
+        return;
+    }
+#endif
     // 1. calculate per-face normals
-    std::vector<std::vector<glm::vec3>> m_faceNormals[2];
-    m_faceNormals[0] = std::vector<std::vector<glm::vec3>>(rows - 1, std::vector<glm::vec3>(cols - 1));
-    m_faceNormals[1] = std::vector<std::vector<glm::vec3>>(rows - 1, std::vector<glm::vec3>(cols - 1));
-    for (GLuint i = 0; i < rows - 1; i++) {
-        for (GLuint j = 0; j < cols - 1; j++) {
-            /*
-                0-------------2
-                |           /   0
-                | upper  /   /  |
-                |     /   /     |
-                |  /   /  lower |
-                1   /           |
-                 1--------------2
-            */
-            glm::vec3 upTri[3]{
-                m_vertices[i][j],
-                m_vertices[i + 1][j],
-                m_vertices[i][j + 1]
-            };
-            glm::vec3 lowTri[3]{
-                m_vertices[i][j + 1],
-                m_vertices[i + 1][j],
-                m_vertices[i + 1][j + 1]
-            };
+    // stored row by row as well, face (i, j) is at index i * (cols - 1) + j
+    start = std::chrono::steady_clock::now();
+    std::vector<glm::vec3> faceNormals[2];
+    faceNormals[0] = std::vector<glm::vec3>((rows - 1) * (cols - 1));
+    faceNormals[1] = std::vector<glm::vec3>((rows - 1) * (cols - 1));
+    m_pool->parallelFor(0, rows - 1, [&](GLuint rowBegin, GLuint rowEnd) {
+        for (GLuint i = rowBegin; i < rowEnd; i++) {
+            for (GLuint j = 0; j < cols - 1; j++) {
+                /*
+                    0-------------2
+                    |           /   0
+                    | upper  /   /  |
+                    |     /   /     |
+                    |  /   /  lower |
+                    1   /           |
+                     1--------------2
+                */
+                glm::vec3 upTri[3]{
+                    m_vertices[i * cols + j],
+                    m_vertices[(i + 1) * cols + j],
+                    m_vertices[i * cols + j + 1]
+                };
+                glm::vec3 lowTri[3]{
+                    m_vertices[i * cols + j + 1],
+                    m_vertices[(i + 1) * cols + j],
+                    m_vertices[(i + 1) * cols + j + 1]
+                };
 
-            m_faceNormals[0][i][j] = glm::normalize(glm::cross(upTri[0] - upTri[2], upTri[1] - upTri[2]));
-            m_faceNormals[1][i][j] = glm::normalize(glm::cross(lowTri[0] - lowTri[2], lowTri[1] - lowTri[2]));
+                faceNormals[0][i * (cols - 1) + j] = glm::normalize(glm::cross(upTri[0] - upTri[2], upTri[1] - upTri[2]));
+                faceNormals[1][i * (cols - 1) + j] = glm::normalize(glm::cross(lowTri[0] - lowTri[2], lowTri[1] - lowTri[2]));
+            }
         }
-    }
+    });
+    m_loadTimes.FaceNormals = elapsedMilliseconds(start);
+
     // 2. sum up all per-face normals around a vertex to get per-vertex normals, i.e. smooth operation
-    m_normals = std::vector<std::vector<glm::vec3>>(rows, std::vector<glm::vec3>(cols));
-    for (GLuint i = 0; i < rows; i++) {
-        for (GLuint j = 0; j < cols; j++) {
-            glm::vec3 sum = glm::vec3(0.f);
+    // every row only reads the face rows above and below it, so the bands are independent
+    start = std::chrono::steady_clock::now();
+    m_pool->parallelFor(0, rows, [&](GLuint rowBegin, GLuint rowEnd) {
+        for (GLuint i = rowBegin; i < rowEnd; i++) {
+            for (GLuint j = 0; j < cols; j++) {
+                glm::vec3 sum = glm::vec3(0.f);
+
+                // top-left
+                if (i != 0 && j != 0)
+                    sum += faceNormals[1][(i - 1) * (cols - 1) + j - 1];
+                // top-right
+                if (i != 0 && j != cols - 1) {
+                    sum += faceNormals[0][(i - 1) * (cols - 1) + j];
+                    sum += faceNormals[1][(i - 1) * (cols - 1) + j];
+                }
+                // bottom-right
+                if (i != rows - 1 && j != cols - 1)
+                    sum += faceNormals[0][i * (cols - 1) + j];
+                // bottom-left
+                if (i != rows - 1 && j != 0) {
+                    sum += faceNormals[0][i * (cols - 1) + j - 1];
+                    sum += faceNormals[1][i * (cols - 1) + j - 1];
+                }
+
+                m_normals[i * cols + j] = glm::normalize(sum);
+            }
+        }
+    });
+    m_loadTimes.VertexNormals = elapsedMilliseconds(start);
+}
+
+#ifdef TERRAIN_SSE
+// Same normals as the scalar path of generateMesh(), 4 faces / vertices at a time.
+// Face normals are stored as separate x, y and z arrays so that 4 neighbouring faces are a single load.
+// Every product, sum and normalization happens in the same order as the scalar path, so both give the same normals.
+void Terrain::generateNormalsSSE(const int& cols, const int& rows) {
+    const GLuint faceCols = cols - 1;
+    const GLuint faceCount = (rows - 1) * faceCols;
+    std::vector<GLfloat> faces(6 * faceCount);
+    GLfloat* upper[3] = { &faces[0], &faces[faceCount], &faces[2 * faceCount] };
+    GLfloat* lower[3] = { &faces[3 * faceCount], &faces[4 * faceCount], &faces[5 * faceCount] };
+    // x of vertex (i, j) minus x of vertex (i, j + 1), the same in every row
+    std::vector<GLfloat> edgesX(faceCols);
+    for (GLuint j = 0; j < faceCols; j++)
+        edgesX[j] = m_vertices[j].x - m_vertices[j + 1].x;
 
-            // top-left
+    // 1. per-face normals. With e the x edge above, d the z edge of the row and h, hx, hz and hxz the heights of
+    // vertices (i, j), (i, j + 1), (i + 1, j) and (i + 1, j + 1), the cross products of the scalar path are
+    // upper = ((h - hx) * d, -(d * e), e * (hz - hx) - e * (h - hx)), lower = ((hz - hxz) * d, -(d * e), -(e * (hx - hxz)))
+    // where the terms multiplied by an exact 0 are left out
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_pool->parallelFor(0, rows - 1, [&](GLuint rowBegin, GLuint rowEnd) {
+        const __m128 zero = _mm_setzero_ps();
+        for (GLuint i = rowBegin; i < rowEnd; i++) {
+            const GLfloat* h = &m_heights[i * cols];
+            const GLfloat* hNext = &m_heights[(i + 1) * cols];
+            const __m128 d = _mm_set1_ps(m_vertices[(i + 1) * cols].z - m_vertices[i * cols].z);
+            GLuint j = 0;
+            for (; j + 4 <= faceCols; j += 4) {
+                __m128 h00 = _mm_loadu_ps(h + j), hx = _mm_loadu_ps(h + j + 1);
+                __m128 hz = _mm_loadu_ps(hNext + j), hxz = _mm_loadu_ps(hNext + j + 1);
+                __m128 e = _mm_loadu_ps(&edgesX[j]);
+                __m128 upY = _mm_sub_ps(h00, hx), upZ = _mm_sub_ps(hz, hx);
+                __m128 lowY = _mm_sub_ps(hx, hxz), lowZ = _mm_sub_ps(hz, hxz);
+                __m128 y = _mm_sub_ps(zero, _mm_mul_ps(d, e));
+                storeNormalSSE(upper, i * faceCols + j, _mm_mul_ps(upY, d), y, _mm_sub_ps(_mm_mul_ps(e, upZ), _mm_mul_ps(e, upY)));
+                storeNormalSSE(lower, i * faceCols + j, _mm_mul_ps(lowZ, d), y, _mm_sub_ps(zero, _mm_mul_ps(e, lowY)));
+            }
+            for (; j < faceCols; j++) {
+                const glm::vec3* v = &m_vertices[i * cols + j];
+                const glm::vec3* vNext = &m_vertices[(i + 1) * cols + j];
+                glm::vec3 up = glm::normalize(glm::cross(v[0] - v[1], vNext[0] - v[1]));
+                glm::vec3 low = glm::normalize(glm::cross(v[1] - vNext[1], vNext[0] - vNext[1]));
+                for (GLuint k = 0; k < 3; k++) {
+                    upper[k][i * faceCols + j] = up[k];
+                    lower[k][i * faceCols + j] = low[k];
+                }
+            }
+        }
+    });
+    m_loadTimes.FaceNormals = elapsedMilliseconds(start);
+
+    // 2. smoothing, border vertices have fewer faces around them and go through the scalar version
+    start = std::chrono::steady_clock::now();
+    auto vertexNormal = [&](GLuint i, GLuint j) {
+        glm::vec3 sum = glm::vec3(0.f);
+        for (GLuint k = 0; k < 3; k++) {
             if (i != 0 && j != 0)
-                sum += m_faceNormals[1][i - 1][j - 1];
-            // top-right
-            if (i != 0 && j != cols - 1) {
-                sum += m_faceNormals[0][i - 1][j];
-                sum += m_faceNormals[1][i - 1][j];
-            }
-            // bottom-right
-            if (i != rows - 1 && j != cols - 1)
-                sum += m_faceNormals[0][i][j];
-            // bottom-left
+                sum[k] += lower[k][(i - 1) * faceCols + j - 1];
+            if (i != 0 && j != faceCols) {
+                sum[k] += upper[k][(i - 1) * faceCols + j];
+                sum[k] += lower[k][(i - 1) * faceCols + j];
+            }
+            if (i != rows - 1 && j != faceCols)
+                sum[k] += upper[k][i * faceCols + j];
             if (i != rows - 1 && j != 0) {
-                sum += m_faceNormals[0][i][j - 1];
-                sum += m_faceNormals[1][i][j - 1];
+                sum[k] += upper[k][i * faceCols + j - 1];
+                sum[k] += lower[k][i * faceCols + j - 1];
             }
+        }
+        m_normals[i * cols + j] = glm::normalize(sum);
+    };
+    m_pool->parallelFor(0, rows, [&](GLuint rowBegin, GLuint rowEnd) {
+        for (GLuint i = rowBegin; i < rowEnd; i++) {
+            if (i == 0 || i == rows - 1) {
+                for (GLuint j = 0; j < cols; j++)
+                    vertexNormal(i, j);
+                continue;
+            }
+            vertexNormal(i, 0);
+            GLuint j = 1;
+            for (; j + 4 <= faceCols; j += 4) {
+                __m128 sum[3];
+                for (GLuint k = 0; k < 3; k++) {
+                    // same order as the scalar path: top-left, top-right, bottom-right, bottom-left
+                    const GLfloat* up = upper[k], * low = lower[k];
+                    sum[k] = _mm_loadu_ps(low + (i - 1) * faceCols + j - 1);
+                    sum[k] = _mm_add_ps(sum[k], _mm_loadu_ps(up + (i - 1) * faceCols + j));
+                    sum[k] = _mm_add_ps(sum[k], _mm_loadu_ps(low + (i - 1) * faceCols + j));
+                    sum[k] = _mm_add_ps(sum[k], _mm_loadu_ps(up + i * faceCols + j));
+                    sum[k] = _mm_add_ps(sum[k], _mm_loadu_ps(up + i * faceCols + j - 1));
+                    sum[k] = _mm_add_ps(sum[k], _mm_loadu_ps(low + i * faceCols + j - 1));
+                }
+                GLfloat normal[3][4];
+                GLfloat* normalPtr[3] = { normal[0], normal[1], normal[2] };
+                storeNormalSSE(normalPtr, 0, sum[0], sum[1], sum[2]);
+                for (GLuint n = 0; n < 4; n++)
+                    m_normals[i * cols + j + n] = glm::vec3(normal[0][n], normal[1][n], normal[2][n]);
+            }
+            for (; j < cols; j++)
+                vertexNormal(i, j);
+        }
+    });
+    m_loadTimes.VertexNormals = elapsedMilliseconds(start);
+}
+
+void Terrain::storeNormalSSE(GLfloat* dst[3], const GLuint& index, const __m128& x, const __m128& y, const __m128& z) {
+    // glm::normalize() multiplies by the inverse length
+    __m128 lengthInverse = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z))));
+    _mm_storeu_ps(dst[0] + index, _mm_mul_ps(x, lengthInverse));
+    _mm_storeu_ps(dst[1] + index, _mm_mul_ps(y, lengthInverse));
+    _mm_storeu_ps(dst[2] + index, _mm_mul_ps(z, lengthInverse));
+}
+#endif
+
+void Terrain::generateChunks() {
+    const GLuint N = TERRAIN_CHUNK_SIZE;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_chunksX = (m_cols - 1 + N - 1) / N;
+    m_chunksZ = (m_rows - 1 + N - 1) / N;
+    m_chunks = std::vector<TerrainChunk>(m_chunksX * m_chunksZ);
+    m_skirtDepth = 0.f;
 
-            m_normals[i][j] = glm::normalize(sum);
+    // every chunk gets its own block of TERRAIN_CHUNK_VERTICES vertices, copied from the grid.
+    // There is no vertex data at all with the height texture
+    GLuint vertexCount = m_vertexFormat == TERRAIN_VERTEX_HEIGHT_TEXTURE ? 0 : m_chunks.size() * TERRAIN_CHUNK_VERTICES;
+    std::vector<glm::vec3> vertices(vertexCount);
+    std::vector<glm::vec2> texCoords(vertexCount);
+    std::vector<glm::vec3> normals(vertexCount);
+
+    m_pool->parallelFor(0, m_chunks.size(), [&](GLuint chunkBegin, GLuint chunkEnd) {
+        for (GLuint chunkIndex = chunkBegin; chunkIndex < chunkEnd; chunkIndex++) {
+            TerrainChunk& chunk = m_chunks[chunkIndex];
+            GLuint row0 = chunkIndex / m_chunksX * N, col0 = chunkIndex % m_chunksX * N;
+
+            updateChunk(chunkIndex);
+            chunk.Lod = 0;
+            chunk.BaseVertex = chunkIndex * TERRAIN_CHUNK_VERTICES;
+            if (m_vertexFormat == TERRAIN_VERTEX_HEIGHT_TEXTURE)
+                continue;
+
+            /************************** Chunk vertices ************************/
+            // grid first, (N + 1) * (N + 1) vertices row by row
+            for (GLuint i = 0; i <= N; i++) {
+                for (GLuint j = 0; j <= N; j++) {
+                    GLuint index = gridIndex(row0 + i, col0 + j);
+                    GLuint local = chunk.BaseVertex + i * (N + 1) + j;
+                    vertices[local] = m_vertices[index];
+                    texCoords[local] = m_texCoords[index];
+                    normals[local] = m_normals[index];
+                }
+            }
+            // then the skirts, edges in order: north (row0), east (col0 + N), south (row0 + N), west (col0)
+            for (GLuint e = 0; e < 4; e++) {
+                for (GLuint k = 0; k <= N; k++) {
+                    GLuint edge = chunk.BaseVertex + skirtEdgeIndex(e, k);
+                    GLuint skirt = chunk.BaseVertex + (N + 1) * (N + 1) + e * (N + 1) + k;
+                    vertices[skirt] = vertices[edge] - glm::vec3(0.f, chunk.SkirtDepth, 0.f);
+                    texCoords[skirt] = texCoords[edge];
+                    normals[skirt] = normals[edge];
+                }
+            }
         }
+    });
+    m_vertices.swap(vertices);
+    m_texCoords.swap(texCoords);
+    m_normals.swap(normals);
+    updateSkirtDepth();
+
+    m_nodes.clear();
+    m_root = buildNode(0, 0, m_chunksX, m_chunksZ);
+    m_loadTimes.Chunks = elapsedMilliseconds(start);
+}
+
+// All chunks have the same layout, so they share one set of chunk-local indices per LOD, drawn with a base vertex
+void Terrain::generateIndices() {
+    const GLuint N = TERRAIN_CHUNK_SIZE;
+    m_indices.clear();
+    for (GLuint lod = 0; lod < TERRAIN_LOD_COUNT; lod++) {
+        GLuint step = 1u << lod;
+        m_lodIndexOffset[lod] = m_indices.size();
+
+        // iterate each square, which is formed by 2 triangles
+        for (GLuint i = 0; i < N; i += step) {
+            for (GLuint j = 0; j < N; j += step) {
+                /*
+                    0-------------2
+                    |           /   0
+                    | upper  /   /  |
+                    |     /   /     |
+                    |  /   /  lower |
+                    1   /           |
+                     1--------------2
+                */
+                // upper triangle, in counter clockwise
+                m_indices.push_back(i * (N + 1) + j);
+                m_indices.push_back((i + step) * (N + 1) + j);
+                m_indices.push_back(i * (N + 1) + j + step);
+
+                // lower triangle, in counter clockwise
+                m_indices.push_back(i * (N + 1) + j + step);
+                m_indices.push_back((i + step) * (N + 1) + j);
+                m_indices.push_back((i + step) * (N + 1) + j + step);
+            }
+        }
+
+        // skirts, hanging down from the edges and facing outwards:
+        // north and east edges are walked backwards, south and west edges forwards
+        for (GLuint e = 0; e < 4; e++) {
+            for (GLuint k = 0; k < N; k += step) {
+                GLuint a = e < 2 ? k + step : k;
+                GLuint b = e < 2 ? k : k + step;
+                GLuint skirtA = (N + 1) * (N + 1) + e * (N + 1) + a;
+                GLuint skirtB = (N + 1) * (N + 1) + e * (N + 1) + b;
+                m_indices.push_back(skirtEdgeIndex(e, a));
+                m_indices.push_back(skirtA);
+                m_indices.push_back(skirtEdgeIndex(e, b));
+
+                m_indices.push_back(skirtEdgeIndex(e, b));
+                m_indices.push_back(skirtA);
+                m_indices.push_back(skirtB);
+            }
+        }
+
+        m_lodIndexCount[lod] = m_indices.size() - m_lodIndexOffset[lod];
     }
 }
 
-void Terrain::bufferUpdate() {
+// Chunk-local index of the k-th grid vertex along edge e (north, east, south, west)
+GLuint Terrain::skirtEdgeIndex(const GLuint& e, const GLuint& k) {
+    const GLuint N = TERRAIN_CHUNK_SIZE;
+    switch (e) {
+    case 0: return k;
+    case 1: return k * (N + 1) + N;
+    case 2: return N * (N + 1) + k;
+    default: return k * (N + 1);
+    }
+}
+
+void Terrain::packVertices() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    GLfloat heightMax = -std::numeric_limits<float>::max();
+    m_heightMin = std::numeric_limits<float>::max();
+    for (const glm::vec3& vertex : m_vertices) {
+        m_heightMin = glm::min(m_heightMin, vertex.y);
+        heightMax = glm::max(heightMax, vertex.y);
+    }
+    m_heightRange = glm::max(heightMax - m_heightMin, 1e-4f);
+
+    m_packedVertices = std::vector<TerrainPackedVertex>(m_vertices.size());
+    m_pool->parallelFor(0, m_vertices.size(), [&](GLuint begin, GLuint end) {
+        for (GLuint i = begin; i < end; i++)
+            m_packedVertices[i] = packVertex(m_vertices[i].y, m_normals[i]);
+    });
+    m_loadTimes.Pack = elapsedMilliseconds(start);
+}
+
+// Heights outside of the packed range (edits after load()) are clamped to it
+TerrainPackedVertex Terrain::packVertex(const GLfloat& height, const glm::vec3& normal) {
+    TerrainPackedVertex packed;
+    packed.Height = (GLushort)glm::round(glm::clamp((height - m_heightMin) / m_heightRange, 0.f, 1.f) * 65535.f);
+    // octahedral encoding: project on the octahedron |x| + |y| + |z| = 1, fold the lower half over the upper one
+    glm::vec3 projected = normal / (glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z));
+    glm::vec2 octahedral = glm::vec2(projected.x, projected.y);
+    if (projected.z < 0.f)
+        octahedral = (1.f - glm::abs(glm::vec2(projected.y, projected.x))) * glm::vec2(projected.x >= 0.f ? 1.f : -1.f, projected.y >= 0.f ? 1.f : -1.f);
+    packed.Normal[0] = (GLubyte)glm::round((octahedral.x * 0.5f + 0.5f) * 255.f);
+    packed.Normal[1] = (GLubyte)glm::round((octahedral.y * 0.5f + 0.5f) * 255.f);
+    return packed;
+}
+
+// Bounds, LOD errors and skirt depth of a chunk, from m_heights
+void Terrain::updateChunk(const GLuint& chunkIndex) {
+    const GLuint N = TERRAIN_CHUNK_SIZE;
+    TerrainChunk& chunk = m_chunks[chunkIndex];
+    GLuint row0 = chunkIndex / m_chunksX * N, col0 = chunkIndex % m_chunksX * N;
+    GLuint row1 = glm::min(row0 + N, m_rows - 1u), col1 = glm::min(col0 + N, m_cols - 1u);
+
+    GLfloat heightMin = std::numeric_limits<float>::max(), heightMax = -std::numeric_limits<float>::max();
+    for (GLuint i = row0; i <= row1; i++) {
+        for (GLuint j = col0; j <= col1; j++) {
+            heightMin = glm::min(heightMin, m_heights[i * m_cols + j]);
+            heightMax = glm::max(heightMax, m_heights[i * m_cols + j]);
+        }
+    }
+    // same positions as generateMesh()
+    chunk.BoundsMin = glm::vec3((col0 / (m_cols - 1.f) - 0.5f) * m_size.x, heightMin, (row0 / (m_rows - 1.f) - 0.5f) * m_size.y);
+    chunk.BoundsMax = glm::vec3((col1 / (m_cols - 1.f) - 0.5f) * m_size.x, heightMax, (row1 / (m_rows - 1.f) - 0.5f) * m_size.y);
+
+    chunk.SkirtDepth = 0.f;
+    for (GLuint lod = 0; lod < TERRAIN_LOD_COUNT; lod++) {
+        chunk.LodError[lod] = lodError(row0, col0, 1u << lod);
+        chunk.SkirtDepth = glm::max(chunk.SkirtDepth, chunk.LodError[lod]);
+    }
+    // a crack between two chunks is never deeper than the error of the coarser one
+    chunk.SkirtDepth += 0.1f;
+    chunk.BoundsMin.y -= glm::max(chunk.SkirtDepth, m_skirtDepth);
+}
+
+// The height texture mode has no per-chunk data, all skirts go down to the deepest one
+// Sets the new skirt depth in every shader given to setShader(), without changing the current program
+void Terrain::uploadSkirtDepth() {
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    for (std::pair<Shader, std::string>& set : m_shaders)
+        set.first.setFloat((set.second + ".skirtDepth").c_str(), m_skirtDepth, true);
+    glUseProgram(program);
+}
+
+void Terrain::updateSkirtDepth() {
+    if (m_vertexFormat != TERRAIN_VERTEX_HEIGHT_TEXTURE)
+        return;
+    GLfloat skirtDepth = m_skirtDepth;
+    for (const TerrainChunk& chunk : m_chunks)
+        m_skirtDepth = glm::max(m_skirtDepth, chunk.SkirtDepth);
+    for (TerrainChunk& chunk : m_chunks)
+        chunk.BoundsMin.y -= m_skirtDepth - glm::max(chunk.SkirtDepth, skirtDepth);
+}
+
+// Nodes are stored after their children, so a single pass updates the whole tree
+void Terrain::updateNodeBounds() {
+    for (TerrainNode& node : m_nodes) {
+        if (node.Chunk >= 0) {
+            node.BoundsMin = m_chunks[node.Chunk].BoundsMin;
+            node.BoundsMax = m_chunks[node.Chunk].BoundsMax;
+            continue;
+        }
+        node.BoundsMin = glm::vec3(std::numeric_limits<float>::max());
+        node.BoundsMax = glm::vec3(-std::numeric_limits<float>::max());
+        for (GLuint i = 0; i < 4; i++) {
+            if (node.Children[i] < 0)
+                continue;
+            node.BoundsMin = glm::min(node.BoundsMin, m_nodes[node.Children[i]].BoundsMin);
+            node.BoundsMax = glm::max(node.BoundsMax, m_nodes[node.Children[i]].BoundsMax);
+        }
+    }
+}
+
+GLint Terrain::buildNode(const GLuint& x0, const GLuint& z0, const GLuint& x1, const GLuint& z1) {
+    TerrainNode node;
+    node.Chunk = -1;
+    node.Children[0] = node.Children[1] = node.Children[2] = node.Children[3] = -1;
+
+    if (x1 - x0 == 1 && z1 - z0 == 1) {
+        const TerrainChunk& chunk = m_chunks[z0 * m_chunksX + x0];
+        node.Chunk = z0 * m_chunksX + x0;
+        node.BoundsMin = chunk.BoundsMin;
+        node.BoundsMax = chunk.BoundsMax;
+    }
+    else {
+        GLuint xm = (x0 + x1 + 1) / 2, zm = (z0 + z1 + 1) / 2;
+        GLuint ranges[4][4] = {
+            { x0, z0, xm, zm },
+            { xm, z0, x1, zm },
+            { x0, zm, xm, z1 },
+            { xm, zm, x1, z1 }
+        };
+        node.BoundsMin = glm::vec3(std::numeric_limits<float>::max());
+        node.BoundsMax = glm::vec3(-std::numeric_limits<float>::max());
+        for (GLuint i = 0; i < 4; i++) {
+            if (ranges[i][0] == ranges[i][2] || ranges[i][1] == ranges[i][3])
+                continue;
+            node.Children[i] = buildNode(ranges[i][0], ranges[i][1], ranges[i][2], ranges[i][3]);
+            node.BoundsMin = glm::min(node.BoundsMin, m_nodes[node.Children[i]].BoundsMin);
+            node.BoundsMax = glm::max(node.BoundsMax, m_nodes[node.Children[i]].BoundsMax);
+        }
+    }
+
+    m_nodes.push_back(node);
+    return m_nodes.size() - 1;
+}
+
+// Max height difference between the full resolution grid and the grid only using every step-th vertex
+GLfloat Terrain::lodError(const GLuint& row0, const GLuint& col0, const GLuint& step) {
+    const GLuint N = TERRAIN_CHUNK_SIZE;
+    GLfloat error = 0.f;
+    if (step == 1)
+        return error;
+
+    for (GLuint i = row0; i < row0 + N; i += step) {
+        for (GLuint j = col0; j < col0 + N; j += step) {
+            GLfloat h00 = m_heights[gridIndex(i, j)];
+            GLfloat h01 = m_heights[gridIndex(i, j + step)];
+            GLfloat h10 = m_heights[gridIndex(i + step, j)];
+            GLfloat h11 = m_heights[gridIndex(i + step, j + step)];
+            for (GLuint di = 0; di <= step; di++) {
+                for (GLuint dj = 0; dj <= step; dj++) {
+                    // same triangulation as the index buffer: upper triangle when u + v <= 1
+                    GLfloat u = (GLfloat)dj / step, v = (GLfloat)di / step;
+                    GLfloat coarse = u + v <= 1.f
+                        ? h00 + u * (h01 - h00) + v * (h10 - h00)
+                        : h11 + (1.f - u) * (h10 - h11) + (1.f - v) * (h01 - h11);
+                    GLfloat fine = m_heights[gridIndex(i + di, j + dj)];
+                    error = glm::max(error, glm::abs(fine - coarse));
+                }
+            }
+        }
+    }
+    return error;
+}
+
+// Index of a grid vertex, rows and columns past the border are clamped (chunks on the border may be partial)
+GLuint Terrain::gridIndex(const GLuint& row, const GLuint& col) {
+    return glm::min(row, m_rows - 1u) * m_cols + glm::min(col, m_cols - 1u);
+}
+
+void Terrain::bufferUpdate(const void* vertexData) {
+    generateIndices();
     glGenVertexArrays(1, &m_VAO);
     glGenBuffers(1, &m_VBO);
     glGenBuffers(1, &m_EBO);
 
     glBindVertexArray(m_VAO);
 
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec2> texCoords;
-    std::vector<glm::vec3> normals;
-
-    // άתһά
-    for (GLuint i = 0; i < m_rows; i++) {
-        for (GLuint j = 0; j < m_cols; j++) {
-            vertices.push_back(m_vertices[i][j]);
-            texCoords.push_back(m_texCoords[i][j]);
-            normals.push_back(m_normals[i][j]);
-        }
+    // float format: all positions, then all texcoords, then all normals. The cache uses the same layout
+    bool packed = m_vertexFormat == TERRAIN_VERTEX_PACKED;
+    bool fromVectors = !vertexData;
+    if (fromVectors) {
+        m_vertexCount = packed ? m_packedVertices.size() : m_vertices.size();
+        if (packed)
+            vertexData = &m_packedVertices[0];
     }
+    GLsizeiptr vertexCount = m_vertexCount;
 
     glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-    glBufferData(GL_ARRAY_BUFFER, m_rows * m_cols * (2 * sizeof(glm::vec3) + sizeof(glm::vec2)), NULL, GL_STATIC_DRAW);
+    if (vertexCount > 0)
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * vertexSize(), packed || !fromVectors ? vertexData : NULL, GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(GLuint), &m_indices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(GLushort), &m_indices[0], GL_STATIC_DRAW);
 
-    // ʹglBufferSubData仺
-    glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(glm::vec3), &vertices[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.size() * sizeof(glm::vec2), &texCoords[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, vertices.size() * (sizeof(glm::vec3) + sizeof(glm::vec2)), vertices.size() * sizeof(glm::vec3), &normals[0]);
+    if (m_vertexFormat == TERRAIN_VERTEX_HEIGHT_TEXTURE) {
+        // no vertex attribute at all, terrain.vs only needs gl_VertexID and the heights
+        glGenTextures(1, &m_heightTexture);
+        glBindTexture(GL_TEXTURE_2D, m_heightTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, m_cols, m_rows, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        uploadHeights(0, 0, m_rows, m_cols);
+    }
+    else if (packed) {
+        // only the height (in aPos.x) and the normal (in aNormal.xy) are stored, texcoords are rebuilt in the shader
+        glVertexAttribPointer(0, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(TerrainPackedVertex), (void*)offsetof(TerrainPackedVertex, Height));
+        glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(TerrainPackedVertex), (void*)offsetof(TerrainPackedVertex, Normal));
+        glEnableVertexAttribArray(2);
+    }
+    else {
+        if (fromVectors) {
+            // ʹglBufferSubData仺, the grids are already contiguous so they are uploaded as they are
+            glBufferSubData(GL_ARRAY_BUFFER, 0, vertexCount * sizeof(glm::vec3), &m_vertices[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec3), vertexCount * sizeof(glm::vec2), &m_texCoords[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, vertexCount * (sizeof(glm::vec3) + sizeof(glm::vec2)), vertexCount * sizeof(glm::vec3), &m_normals[0]);
+        }
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)(m_rows * m_cols * sizeof(glm::vec3)));
-    glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)(vertexCount * sizeof(glm::vec3)));
+        glEnableVertexAttribArray(1);
 
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(m_rows * m_cols * (sizeof(glm::vec3) + +sizeof(glm::vec2))));
-    glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(vertexCount * (sizeof(glm::vec3) + sizeof(glm::vec2))));
+        glEnableVertexAttribArray(2);
+    }
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+
+    // the GPU owns the mesh now, only the heights are kept for queries
+    std::vector<glm::vec3>().swap(m_vertices);
+    std::vector<glm::vec2>().swap(m_texCoords);
+    std::vector<glm::vec3>().swap(m_normals);
+    std::vector<TerrainPackedVertex>().swap(m_packedVertices);
+    std::vector<GLushort>().swap(m_indices);
+}
+
+bool Terrain::loadCache(const std::string& path, const TerrainCacheHeader& key) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(TerrainCacheHeader))
+        return false;
+    TerrainCacheHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.Magic, key.Magic, 4) != 0 || header.Version != key.Version || header.Hash != key.Hash
+        || header.Size != key.Size || header.HeightScale != key.HeightScale || header.TextureScale != key.TextureScale
+        || header.ChunkSize != key.ChunkSize || header.LodCount != key.LodCount || header.ChunkVertexCount != TERRAIN_CHUNK_VERTICES
+        || header.VertexFormat != key.VertexFormat || header.VertexSize != key.VertexSize)
+        return false;
+
+    size_t chunkBytes = header.ChunksX * header.ChunksZ * sizeof(TerrainChunk);
+    size_t nodeBytes = header.NodeCount * sizeof(TerrainNode);
+    size_t heightBytes = header.Cols * header.Rows * sizeof(GLfloat);
+    size_t vertexBytes = header.VertexCount * header.VertexSize;
+    if (file.size() != sizeof(header) + chunkBytes + nodeBytes + heightBytes + vertexBytes) {
+        std::cout << "ERROR::TERRAIN: Corrupted cache " << path << ", regenerating it" << std::endl;
+        return false;
+    }
+
+    const unsigned char* data = file.data() + sizeof(header);
+    m_size = header.Size;
+    m_cols = header.Cols;
+    m_rows = header.Rows;
+    m_gridScale = glm::vec2((m_cols - 1) / m_size.x, (m_rows - 1) / m_size.y);
+    m_textureScale = header.TextureScale;
+    m_heightMin = header.HeightMin;
+    m_heightRange = header.HeightRange;
+    m_chunksX = header.ChunksX;
+    m_chunksZ = header.ChunksZ;
+    m_root = header.Root;
+    m_chunks.resize(header.ChunksX * header.ChunksZ);
+    memcpy(&m_chunks[0], data, chunkBytes);
+    data += chunkBytes;
+    m_nodes.resize(header.NodeCount);
+    memcpy(&m_nodes[0], data, nodeBytes);
+    data += nodeBytes;
+    m_heights.resize(header.Cols * header.Rows);
+    memcpy(&m_heights[0], data, heightBytes);
+    data += heightBytes;
+    buildHeightPyramid();
+    // the cached bounds already include the skirts
+    m_skirtDepth = 0.f;
+    if (m_vertexFormat == TERRAIN_VERTEX_HEIGHT_TEXTURE)
+        for (const TerrainChunk& chunk : m_chunks)
+            m_skirtDepth = glm::max(m_skirtDepth, chunk.SkirtDepth);
+    m_loadTimes.Cache = elapsedMilliseconds(start);
+
+    // the vertex blob goes to the driver straight from the mapping
+    start = std::chrono::steady_clock::now();
+    m_vertexCount = header.VertexCount;
+    bufferUpdate(data);
+    m_loadTimes.Upload = elapsedMilliseconds(start);
+    return true;
 }
 
-// ֵ߶
-float Terrain::barryCentric(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, glm::vec2 pos) {
-    GLfloat det = (p2.z - p3.z) * (p1.x - p3.x) + (p3.x - p2.x) * (p1.z - p3.z);
-    GLfloat l1 = ((p2.z - p3.z) * (pos.x - p3.x) + (p3.x - p2.x) * (pos.y - p3.z)) / det;
-    GLfloat l2 = ((p3.z - p1.z) * (pos.x - p3.x) + (p1.x - p3.x) * (pos.y - p3.z)) / det;
-    GLfloat l3 = 1.0f - l1 - l2;
-    return l1 * p1.y + l2 * p2.y + l3 * p3.y;
-}
\ No newline at end of file
+void Terrain::saveCache(const std::string& path, const TerrainCacheHeader& key) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TerrainCacheHeader header = key;
+    header.Cols = m_cols;
+    header.Rows = m_rows;
+    header.ChunksX = m_chunksX;
+    header.ChunksZ = m_chunksZ;
+    header.NodeCount = m_nodes.size();
+    header.Root = m_root;
+    header.VertexCount = m_vertexFormat == TERRAIN_VERTEX_PACKED ? m_packedVertices.size() : m_vertices.size();
+    header.ChunkVertexCount = TERRAIN_CHUNK_VERTICES;
+    header.HeightMin = m_heightMin;
+    header.HeightRange = m_heightRange;
+
+    // written to a temporary file first, so that an interrupted write never leaves a broken cache behind
+    std::string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)&m_chunks[0], m_chunks.size() * sizeof(TerrainChunk));
+    file.write((const char*)&m_nodes[0], m_nodes.size() * sizeof(TerrainNode));
+    file.write((const char*)&m_heights[0], m_heights.size() * sizeof(GLfloat));
+    if (m_vertexFormat == TERRAIN_VERTEX_PACKED)
+        file.write((const char*)&m_packedVertices[0], m_packedVertices.size() * sizeof(TerrainPackedVertex));
+    else {
+        file.write((const char*)&m_vertices[0], m_vertices.size() * sizeof(glm::vec3));
+        file.write((const char*)&m_texCoords[0], m_texCoords.size() * sizeof(glm::vec2));
+        file.write((const char*)&m_normals[0], m_normals.size() * sizeof(glm::vec3));
+    }
+    file.close();
+    if (!file) {
+        std::cout << "ERROR::TERRAIN: Failed to write cache " << path << std::endl;
+        std::remove(tempPath.c_str());
+        return;
+    }
+    std::remove(path.c_str());
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+        std::cout << "ERROR::TERRAIN: Failed to write cache " << path << std::endl;
+    m_loadTimes.Cache = elapsedMilliseconds(start);
+}
+
+// FNV-1a, only used to tell heightmaps apart
+GLuint64 Terrain::hashBytes(const unsigned char* data, const size_t& size) {
+    GLuint64 hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
@@ -1,31 +1,244 @@
 #pragma once
 
 #include <vector>
+#include <string>
 #include <iostream>
+#include <chrono>
+#include <memory>
+#include <utility>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "thread_pool.h"
+#include "shader.h"
+#include "terrain_clipmap.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_SSE
+#include <emmintrin.h>
+#endif
+// AVX2 is built on x64 even when the compiler may not use it elsewhere (no /arch:AVX2 or -mavx2),
+// getHeights() only takes that path when the CPU has it
+#if defined(__AVX2__) || defined(_M_X64) || (defined(__GNUC__) && defined(__x86_64__))
+#define TERRAIN_AVX2
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define TERRAIN_AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define TERRAIN_AVX2_FUNCTION
+#endif
+#endif
+
+class Camera;
+struct Plane;
+
+// The heightmap is split into square chunks of TERRAIN_CHUNK_SIZE cells. Every chunk has one index set per LOD,
+// LOD n only uses every (2^n)-th vertex of the grid.
+const GLuint TERRAIN_CHUNK_SIZE = 64;
+const GLuint TERRAIN_LOD_COUNT = 5;
+// vertices of one chunk: the (N + 1) * (N + 1) grid followed by 4 skirts of N + 1 vertices, must fit 16-bit indices
+const GLuint TERRAIN_CHUNK_VERTICES = (TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1) + 4 * (TERRAIN_CHUNK_SIZE + 1);
+
+struct TerrainChunk {
+    glm::vec3 BoundsMin, BoundsMax; // AABB in world space, skirts included
+    GLfloat   LodError[TERRAIN_LOD_COUNT]; // max height difference (world units) between each LOD and the full mesh
+    GLfloat   SkirtDepth;
+    GLint     BaseVertex; // first vertex of the chunk inside the VBO
+    GLuint    Lod; // LOD picked by the last update()
+};
+
+// Layout of the terrain VBO
+enum Terrain_Vertex_Format {
+    TERRAIN_VERTEX_FLOAT, // vec3 position, vec2 texcoords and vec3 normal, 32 bytes
+    TERRAIN_VERTEX_PACKED, // 16-bit height and 8-bit octahedral normal, 4 bytes. x / z and texcoords are rebuilt from gl_VertexID
+    TERRAIN_VERTEX_HEIGHT_TEXTURE // no vertex data, terrain.vs displaces the grid with an R16 height texture and derives the normals
+};
+
+// texture unit the height texture is bound to by render()
+const GLuint TERRAIN_HEIGHT_TEXTURE_UNIT = 7;
+
+struct TerrainPackedVertex {
+    GLushort Height; // 0..65535 for m_heightMin..m_heightMin + m_heightRange
+    GLubyte  Normal[2]; // octahedral encoding, 0..255 for -1..1
+};
+
+// Binary cache written next to the heightmap (<heightmap>.cache), holding everything load() generates.
+// Bump the version whenever the layout of the file or of TerrainChunk / TerrainNode changes.
+const GLuint TERRAIN_CACHE_VERSION = 4;
+
+struct TerrainCacheHeader {
+    // key, the cache is rebuilt if any of these differ
+    char      Magic[4];
+    GLuint    Version;
+    GLuint64  Hash; // of the heightmap file
+    glm::vec2 Size;
+    GLfloat   HeightScale, TextureScale;
+    GLuint    ChunkSize, LodCount;
+    GLuint    VertexFormat, VertexSize;
+    // content, followed by the chunks, nodes, heights and vertex blob (positions, texcoords, normals)
+    GLuint    Cols, Rows;
+    GLuint    ChunksX, ChunksZ;
+    GLuint    NodeCount;
+    GLint     Root;
+    GLuint    VertexCount, ChunkVertexCount;
+    GLfloat   HeightMin, HeightRange;
+};
+
+// Time spent in each stage of the last load(), in milliseconds
+struct TerrainLoadTimes {
+    GLdouble Decode = 0.0, Vertices = 0.0, FaceNormals = 0.0, VertexNormals = 0.0, Chunks = 0.0, Pack = 0.0, Cache = 0.0, Upload = 0.0;
+    GLdouble total() const { return Decode + Vertices + FaceNormals + VertexNormals + Chunks + Pack + Cache + Upload; }
+};
+
+// Quadtree node built on top of the chunks, so that whole groups of chunks can be culled at once
+struct TerrainNode {
+    glm::vec3 BoundsMin, BoundsMax;
+    GLint     Children[4]; // -1 if absent
+    GLint     Chunk; // index of the chunk for leaves, -1 otherwise
+};
+
 class Terrain {
 public:
     Terrain() = default;
     ~Terrain();
     void load(const glm::vec2& size, const float& heightScale, const float& textureScale, std::string HeightMapLoc);
+    // Switches to a geometry clipmap of levelCount levels fed by source instead of a heightmap, for worlds too large to load whole.
+    // spacing is the size in world units of the finest cells and textureScale the texture repeats per world unit.
+    // update() then recenters the clipmap on the camera, call setShader() again after it
+    void loadClipmap(const GLuint& levelCount, const GLfloat& spacing, const GLfloat& heightMin, const GLfloat& heightRange,
+        const GLfloat& textureScale, const TerrainHeightSource& source);
+    // CPU side of load(): builds the mesh, normals and chunks of a decoded heightmap without touching OpenGL
+    void generate(const glm::vec2& size, const float& heightScale, const float& textureScale, const int& cols, const int& rows, unsigned char* heightMap);
+    // Picks the LOD of every chunk, so that its screen-space error stays below m_pixelError
+    void update(Camera& camera, const GLfloat& viewportHeight);
+    // Renders all chunks with the LOD picked by the last update()
     void render();
+    // Renders the chunks touching the frustum only. The clipmap has a constant cost and is always drawn whole
+    void render(const Plane* frustum, const GLuint& planeCount = 6);
+    // Same, each chunk at its coarsest LOD within maxError world units of the full mesh, whatever the camera: for the
+    // renders kept across frames, e.g. the static shadow casters. The clipmap is drawn whole, see getRevision()
+    void renderFixedLod(const Plane* frustum, const GLuint& planeCount, const GLfloat& maxError);
     float getHeight(const float& worldX, const float& worldZ);
+    // Heights of count (x, z) points at once, 4 or 8 at a time with SSE / AVX2, same results as getHeight()
+    void getHeights(const glm::vec2* positions, GLfloat* heights, const GLuint& count);
+    // Closest hit of the ray origin + t * direction (0 <= t <= maxDistance) with the terrain mesh, found by walking the
+    // min / max height pyramid front to back. distance, if given, receives t. Not available with the clipmap
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, const GLfloat& maxDistance, glm::vec3& hit, GLfloat* distance = nullptr);
+    // With the clipmap, the area covered by its coarsest level around the camera
     glm::vec2 getSize() { return m_size; };
+    // Changes whenever renderFixedLod() would draw something else: load(), height edits, vertex format, switch to
+    // the clipmap and moves of its levels. Renders kept across frames are stale when it changed
+    GLuint getRevision() { return m_revision; }
+    void setPixelError(const GLfloat& pixelError) { m_pixelError = pixelError; }
+    // Pool splitting the mesh generation, the shared one by default
+    void setThreadPool(ThreadPool& pool) { m_pool = &pool; }
+    // Smooth normals with SSE, only has an effect if the build targets SSE2
+    void setSimdNormals(const bool& simdNormals) { m_simdNormals = simdNormals; }
+    // Layout of the vertex buffer, to be set before load(). The packed and height texture formats need the shaders to go through terrain_vertex.glsl
+    void setVertexFormat(const Terrain_Vertex_Format& vertexFormat) { m_vertexFormat = vertexFormat; m_revision++; }
+    // Sets the uniforms terrain_vertex.glsl needs to unpack the vertices, to be called after load()
+    void setShader(Shader& shader, std::string Name, GLboolean UseShader);
+    GLsizeiptr getVertexBufferSize() { return (GLsizeiptr)m_vertexCount * vertexSize(); }
+    // Read and write the binary cache in load(), on by default
+    void setUseCache(const bool& useCache) { m_useCache = useCache; }
+    const TerrainLoadTimes& getLoadTimes() { return m_loadTimes; }
+    // Replaces the heights of the rows x cols rectangle starting at (row0, col0), given row by row, after load().
+    // Only the normals around the rectangle are recomputed and only the touched rows of each chunk are uploaded.
+    // The packed format and the height texture clamp heights to the range they were built with ([0, heightScale] for the texture)
+    void setHeights(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols, const GLfloat* heights);
+    // Same as setHeights(), adding deltas to the current heights
+    void addHeights(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols, const GLfloat* deltas);
 private:
     // mesh, m_sizeų̶
     glm::vec2 m_size;
-    GLuint m_VAO, m_VBO, m_EBO;
+    GLuint m_VAO = 0, m_VBO = 0, m_EBO = 0;
+    GLuint m_vertexCount = 0;
     int m_cols, m_rows;
-    std::vector<std::vector<glm::vec3>> m_vertices;
-    std::vector<GLuint> m_indices; // ((rows - 1) * (cols - 1) * 2 * 3) indices in total
-    std::vector<std::vector<glm::vec2>> m_texCoords;
-    std::vector<std::vector<glm::vec3>> m_normals;
+    std::vector<GLfloat> m_heights; // rows * cols, kept for height queries
+    glm::vec2 m_gridScale; // cells per world unit
+    GLfloat m_textureScale;
+    Terrain_Vertex_Format m_vertexFormat = TERRAIN_VERTEX_PACKED;
+    GLfloat m_heightMin = 0.f, m_heightRange = 1.f; // range of the packed heights (skirts included) or of the height texture
+    GLuint m_heightTexture = 0;
+    GLfloat m_skirtDepth = 0.f; // deepest skirt, used by the height texture
+    // shaders given to setShader() and the names of their grid, whose skirtDepth follows the height edits
+    std::vector<std::pair<Shader, std::string>> m_shaders;
+    std::vector<TerrainPackedVertex> m_packedVertices;
+    // mesh data, released once uploaded: the whole grid (rows * cols, row by row) until generateChunks()
+    // copies it into one block of TERRAIN_CHUNK_VERTICES vertices per chunk
+    std::vector<glm::vec3> m_vertices;
+    std::vector<GLushort> m_indices; // chunk-local grid and skirt indices of every LOD, shared by all chunks
+    GLuint m_lodIndexOffset[TERRAIN_LOD_COUNT]; // first index of each LOD inside the EBO
+    GLsizei m_lodIndexCount[TERRAIN_LOD_COUNT];
+    std::vector<glm::vec2> m_texCoords;
+    std::vector<glm::vec3> m_normals;
+
+    // chunks
+    GLuint m_chunksX, m_chunksZ;
+    std::vector<TerrainChunk> m_chunks;
+    std::vector<TerrainNode> m_nodes;
+    GLint m_root;
+    GLfloat m_pixelError = 2.0f;
+    GLuint m_revision = 0;
+    // draw list filled by render(), m_fixedLodError >= 0 when filled by renderFixedLod()
+    GLfloat m_fixedLodError = -1.f;
+    std::vector<GLsizei> m_drawCounts;
+    std::vector<const void*> m_drawOffsets;
+    std::vector<GLint> m_drawBaseVertices;
+    // min / max height pyramid for raycast(), level l has one entry per 2^l x 2^l cells, stored row by row after the level below
+    std::vector<GLfloat> m_pyramidMin, m_pyramidMax;
+    std::vector<GLuint> m_pyramidOffset;
+    std::vector<glm::uvec2> m_pyramidSize; // (columns, rows) of every level
+    std::unique_ptr<TerrainClipmap> m_clipmap;
+    // loading
+    ThreadPool* m_pool = &ThreadPool::shared();
+    bool m_simdNormals = true;
+    bool m_useCache = true;
+    TerrainLoadTimes m_loadTimes;
 
     void generateMesh(const glm::vec2& size, const float& heightScale, const float& textureScale, const int& cols, const int& rows, unsigned char* heightMap);
-    void bufferUpdate();
-    float barryCentric(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, glm::vec2 pos);
+#ifdef TERRAIN_SSE
+    void generateNormalsSSE(const int& cols, const int& rows);
+    static void storeNormalSSE(GLfloat* dst[3], const GLuint& index, const __m128& x, const __m128& y, const __m128& z);
+#endif
+    void generateChunks();
+#ifdef TERRAIN_SSE
+    void getHeightsSSE(const glm::vec2* positions, GLfloat* heights);
+#endif
+#ifdef TERRAIN_AVX2
+    TERRAIN_AVX2_FUNCTION void getHeightsAVX2(const glm::vec2* positions, GLfloat* heights);
+#endif
+    GLint buildNode(const GLuint& x0, const GLuint& z0, const GLuint& x1, const GLuint& z1);
+    GLfloat lodError(const GLuint& row0, const GLuint& col0, const GLuint& step);
+    GLuint gridIndex(const GLuint& row, const GLuint& col);
+    void generateIndices();
+    void packVertices();
+    GLuint vertexSize() {
+        return m_vertexFormat == TERRAIN_VERTEX_FLOAT ? 2 * sizeof(glm::vec3) + sizeof(glm::vec2)
+            : m_vertexFormat == TERRAIN_VERTEX_PACKED ? sizeof(TerrainPackedVertex) : 0;
+    }
+    void updateChunk(const GLuint& chunkIndex);
+    void updateSkirtDepth();
+    void uploadSkirtDepth();
+    void updateNodeBounds();
+    void uploadHeights(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols);
+    void buildHeightPyramid();
+    void updateHeightPyramid(const GLuint& firstRow, const GLuint& firstCol, const GLuint& lastRow, const GLuint& lastCol);
+    bool checkRegion(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols);
+    void updateRegion(const GLuint& row0, const GLuint& col0, const GLuint& rows, const GLuint& cols);
+    void uploadChunkRows(const GLuint& chunkIndex, const GLuint& firstRow, const GLuint& lastRow);
+    glm::vec3 gridPosition(const GLuint& row, const GLuint& col);
+    glm::vec3 gridNormal(const GLuint& row, const GLuint& col);
+    TerrainPackedVertex packVertex(const GLfloat& height, const glm::vec3& normal);
+    GLuint skirtEdgeIndex(const GLuint& e, const GLuint& k);
+    void cullNode(const GLint& index, const Plane* frustum, const GLuint& planeCount, GLuint planeMask);
+    void pushDraw(const TerrainChunk& chunk);
+    void draw();
+    // Uploads the given vertex blob, or the mesh vectors if vertexData is NULL, and the shared indices
+    void bufferUpdate(const void* vertexData);
+    bool loadCache(const std::string& path, const TerrainCacheHeader& key);
+    void saveCache(const std::string& path, const TerrainCacheHeader& key);
+    static GLuint64 hashBytes(const unsigned char* data, const size_t& size);
 };
\ No newline at end of file
@@ -0,0 +1,188 @@
+#include <cmath>
+#include <iostream>
+
+#include "terrain_clipmap.h"
+
+// vertices of one level, the base vertex of level l is l * CLIPMAP_VERTICES so that gl_VertexID gives the level back
+static const GLuint CLIPMAP_VERTICES = (TERRAIN_CLIPMAP_SIZE + 1) * (TERRAIN_CLIPMAP_SIZE + 1);
+
+TerrainClipmap::TerrainClipmap(const GLuint& levelCount, const GLfloat& spacing, const GLfloat& heightMin, const GLfloat& heightRange,
+    const GLfloat& textureScale, const TerrainHeightSource& source)
+    : m_levelCount(glm::clamp(levelCount, 1u, TERRAIN_CLIPMAP_LEVELS_MAX)), m_spacing(spacing), m_heightMin(heightMin),
+    m_heightRange(heightRange), m_textureScale(textureScale), m_source(source), m_origins(m_levelCount), m_valid(m_levelCount, false) {
+    if (levelCount != m_levelCount)
+        std::cout << "ERROR::TERRAIN: Clipmap level count clamped to " << m_levelCount << std::endl;
+
+    // one grid of SIZE x SIZE cells, row by row. A rectangle of whole rows is a prefix of it, and so is a part of a single row
+    const GLuint M = TERRAIN_CLIPMAP_SIZE;
+    std::vector<GLushort> indices;
+    indices.reserve(M * M * 6);
+    for (GLuint i = 0; i < M; i++) {
+        for (GLuint j = 0; j < M; j++) {
+            // same triangles as Terrain::generateIndices(), in counter clockwise
+            indices.push_back(i * (M + 1) + j);
+            indices.push_back((i + 1) * (M + 1) + j);
+            indices.push_back(i * (M + 1) + j + 1);
+
+            indices.push_back(i * (M + 1) + j + 1);
+            indices.push_back((i + 1) * (M + 1) + j);
+            indices.push_back((i + 1) * (M + 1) + j + 1);
+        }
+    }
+    // no vertex attribute, only the indices
+    glGenVertexArrays(1, &m_VAO);
+    glGenBuffers(1, &m_EBO);
+    glBindVertexArray(m_VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    const GLuint T = TERRAIN_CLIPMAP_TEXTURE_SIZE;
+    glGenTextures(1, &m_heightTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_heightTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, T, T, m_levelCount, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+TerrainClipmap::~TerrainClipmap() {
+    glDeleteVertexArrays(1, &m_VAO);
+    glDeleteBuffers(1, &m_EBO);
+    glDeleteTextures(1, &m_heightTexture);
+}
+
+bool TerrainClipmap::update(const glm::vec3& position) {
+    const GLint M = TERRAIN_CLIPMAP_SIZE;
+    m_center = position;
+    m_uploadedSamples = 0;
+    bool levelMoved = false;
+    for (GLuint level = 0; level < m_levelCount; level++) {
+        // center the level on the camera, keeping its origin even
+        GLfloat levelSpacing = m_spacing * (1u << level);
+        glm::ivec2 origin = 2 * glm::ivec2(glm::floor((glm::vec2(position.x, position.z) / levelSpacing - M * 0.5f) * 0.5f));
+        glm::ivec2 old = m_origins[level];
+        m_origins[level] = origin;
+
+        glm::ivec2 moved = origin - old;
+        levelMoved = levelMoved || !m_valid[level] || moved != glm::ivec2(0);
+        if (!m_valid[level] || glm::abs(moved.x) > M || glm::abs(moved.y) > M) {
+            uploadRegion(level, origin.x, origin.y, M + 1, M + 1);
+            m_valid[level] = true;
+            continue;
+        }
+        // columns, then rows that came into the level. The samples that stayed are already in the texture
+        if (moved.x != 0)
+            uploadRegion(level, moved.x > 0 ? old.x + M + 1 : origin.x, origin.y, glm::abs(moved.x), M + 1);
+        if (moved.y != 0)
+            uploadRegion(level, origin.x, moved.y > 0 ? old.y + M + 1 : origin.y, M + 1, glm::abs(moved.y));
+    }
+
+    // level 0 is a full grid, the others are rings around the previous level
+    m_drawCounts.clear();
+    m_drawOffsets.clear();
+    m_drawBaseVertices.clear();
+    pushRows(0, 0, 0, M, M);
+    for (GLuint level = 1; level < m_levelCount; level++) {
+        // the previous level covers SIZE / 2 cells of this one, starting at cell hole
+        glm::ivec2 hole = m_origins[level - 1] / 2 - m_origins[level];
+        pushRows(level, 0, 0, hole.y, M);
+        pushRows(level, hole.y, 0, M / 2, hole.x);
+        pushRows(level, hole.y, hole.x + M / 2, M / 2, M / 2 - hole.x);
+        pushRows(level, hole.y + M / 2, 0, M / 2 - hole.y, M);
+    }
+    return levelMoved;
+}
+
+void TerrainClipmap::render() {
+    if (m_drawCounts.empty())
+        return;
+    glActiveTexture(GL_TEXTURE0 + TERRAIN_CLIPMAP_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_heightTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(m_VAO);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &m_drawCounts[0], GL_UNSIGNED_SHORT, &m_drawOffsets[0], m_drawCounts.size(), &m_drawBaseVertices[0]);
+    glBindVertexArray(0);
+}
+
+void TerrainClipmap::setShader(Shader& shader, std::string Name, GLboolean UseShader) {
+    if (UseShader)
+        shader.use();
+    shader.setInteger((Name + ".vertexFormat").c_str(), TERRAIN_CLIPMAP_VERTEX_FORMAT);
+    shader.setFloat((Name + ".textureScale").c_str(), m_textureScale);
+    shader.setFloat((Name + ".heightMin").c_str(), m_heightMin);
+    shader.setFloat((Name + ".heightRange").c_str(), m_heightRange);
+    shader.setInteger((Name + ".clipmapLevels").c_str(), m_levelCount);
+    shader.setFloat((Name + ".clipmapSpacing").c_str(), m_spacing);
+    shader.setVector2f((Name + ".clipmapCenter").c_str(), m_center.x, m_center.z);
+    for (GLuint level = 0; level < m_levelCount; level++)
+        shader.setVector2f((Name + ".clipmapOrigins[" + std::to_string(level) + "]").c_str(), glm::vec2(m_origins[level]));
+    shader.setInteger("terrainClipmap", TERRAIN_CLIPMAP_TEXTURE_UNIT);
+}
+
+float TerrainClipmap::getHeight(const float& worldX, const float& worldZ) {
+    GLfloat gridX = worldX / m_spacing, gridZ = worldZ / m_spacing;
+    GLfloat cellX = std::floor(gridX), cellZ = std::floor(gridZ);
+    GLfloat xCoordSquare = gridX - cellX;
+    GLfloat zCoordSquare = gridZ - cellZ;
+    GLfloat cell[4];
+    m_source((GLint)cellX, (GLint)cellZ, 2, 2, 1, cell);
+
+    // same triangles as the mesh, see Terrain::getHeight()
+    if (xCoordSquare <= 1 - zCoordSquare) // Left triangle
+        return cell[0] + xCoordSquare * (cell[1] - cell[0]) + zCoordSquare * (cell[2] - cell[0]);
+    else // Right triangle
+        return cell[3] + (1 - xCoordSquare) * (cell[2] - cell[3]) + (1 - zCoordSquare) * (cell[1] - cell[3]);
+}
+
+// Reads the given samples of a level from the source and writes them to its layer, split where the texture wraps
+void TerrainClipmap::uploadRegion(const GLuint& level, const GLint& x0, const GLint& z0, const GLuint& cols, const GLuint& rows) {
+    const GLint T = TERRAIN_CLIPMAP_TEXTURE_SIZE;
+    GLuint step = 1u << level;
+    m_heights.resize(cols * rows);
+    m_texels.resize(cols * rows);
+    m_source(x0 * (GLint)step, z0 * (GLint)step, cols, rows, step, &m_heights[0]);
+    for (GLuint i = 0; i < cols * rows; i++) {
+        GLfloat height = (m_heights[i] - m_heightMin) / m_heightRange;
+        m_texels[i] = (GLushort)glm::round(glm::clamp(height, 0.f, 1.f) * 65535.f);
+    }
+    m_uploadedSamples += cols * rows;
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_heightTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, cols);
+    // toroidal addressing, a region is at most split in 2 x 2 rectangles
+    GLuint firstCols = glm::min((GLint)cols, T - (x0 & (T - 1)));
+    GLuint firstRows = glm::min((GLint)rows, T - (z0 & (T - 1)));
+    for (GLuint i = 0; i < rows; i = i == 0 ? firstRows : rows) {
+        GLuint blockRows = i == 0 ? firstRows : rows - firstRows;
+        for (GLuint j = 0; j < cols; j = j == 0 ? firstCols : cols) {
+            GLuint blockCols = j == 0 ? firstCols : cols - firstCols;
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, j);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, i);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, (x0 + j) & (T - 1), (z0 + i) & (T - 1), level, blockCols, blockRows, 1,
+                GL_RED, GL_UNSIGNED_SHORT, &m_texels[0]);
+        }
+    }
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Queues the rows x cols cells of a level starting at cell (row, col)
+void TerrainClipmap::pushRows(const GLuint& level, const GLuint& row, const GLuint& col, const GLuint& rows, const GLuint& cols) {
+    const GLuint M = TERRAIN_CLIPMAP_SIZE;
+    if (rows == 0 || cols == 0)
+        return;
+    // whole rows are drawn at once
+    GLuint drawRows = cols == M ? 1 : rows;
+    for (GLuint i = 0; i < drawRows; i++) {
+        m_drawCounts.push_back((cols == M ? rows : 1) * cols * 6);
+        m_drawOffsets.push_back(0);
+        m_drawBaseVertices.push_back(level * CLIPMAP_VERTICES + (row + i) * (M + 1) + col);
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <functional>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+
+// Cells per side of every clipmap level, must be even. Level l has a spacing of 2^l cells of level 0
+const GLuint TERRAIN_CLIPMAP_SIZE = 126;
+// Side of each layer of the height texture, a power of two holding the SIZE + 1 vertices of a level
+const GLuint TERRAIN_CLIPMAP_TEXTURE_SIZE = 128;
+// must match the size of TerrainGrid.clipmapOrigins in terrain_vertex.glsl
+const GLuint TERRAIN_CLIPMAP_LEVELS_MAX = 12;
+// texture unit the height texture array is bound to by render()
+const GLuint TERRAIN_CLIPMAP_TEXTURE_UNIT = 8;
+// vertexFormat of terrain_vertex.glsl for the clipmap (TERRAIN_VERTEX_CLIPMAP), after the ones of Terrain_Vertex_Format
+const GLint TERRAIN_CLIPMAP_VERTEX_FORMAT = 3;
+
+// Fills heights with the rows x cols samples of the world heightfield starting at sample (x0, z0), row by row,
+// sample (x, z) being at world position (x, z) * spacing. Consecutive samples are step samples apart
+typedef std::function<void(GLint x0, GLint z0, GLuint cols, GLuint rows, GLuint step, GLfloat* heights)> TerrainHeightSource;
+
+/* Geometry clipmap: nested square rings of TERRAIN_CLIPMAP_SIZE cells centered on the camera, each one twice as
+coarse as the previous one, so that the vertex count does not depend on the size of the world.
+Every level keeps its heights in one layer of an R16 texture array addressed toroidally (sample x is stored at
+x mod TERRAIN_CLIPMAP_TEXTURE_SIZE), so moving the camera only uploads the strips of samples that became visible.
+The grid itself has no vertex data, terrain_vertex.glsl rebuilds it from gl_VertexID. */
+class TerrainClipmap {
+public:
+    // heights are stored as 16-bit values over [heightMin, heightMin + heightRange]
+    TerrainClipmap(const GLuint& levelCount, const GLfloat& spacing, const GLfloat& heightMin, const GLfloat& heightRange,
+        const GLfloat& textureScale, const TerrainHeightSource& source);
+    ~TerrainClipmap();
+    TerrainClipmap(const TerrainClipmap&) = delete;
+    TerrainClipmap& operator=(const TerrainClipmap&) = delete;
+    // Recenters the levels on position and uploads the newly exposed samples, returns true when a level moved
+    bool update(const glm::vec3& position);
+    void render();
+    // Sets the uniforms of terrain_vertex.glsl. The origins of the levels move in update(), so call it after each update()
+    void setShader(Shader& shader, std::string Name, GLboolean UseShader);
+    // Side in world units of the area covered by the coarsest level
+    GLfloat getExtent() { return TERRAIN_CLIPMAP_SIZE * m_spacing * (1u << (m_levelCount - 1)); }
+    // Height of the level 0 mesh, read from the source
+    float getHeight(const float& worldX, const float& worldZ);
+    // Samples uploaded by the last update()
+    GLuint getUploadedSamples() { return m_uploadedSamples; }
+private:
+    GLuint m_levelCount;
+    GLfloat m_spacing;
+    GLfloat m_heightMin, m_heightRange;
+    GLfloat m_textureScale;
+    TerrainHeightSource m_source;
+    GLuint m_VAO = 0, m_EBO = 0;
+    GLuint m_heightTexture = 0;
+    glm::vec3 m_center = glm::vec3(0.f);
+    // first sample of every level in its own samples, always even so that it lies on the next level.
+    // m_valid is false until the level was uploaded once
+    std::vector<glm::ivec2> m_origins;
+    std::vector<bool> m_valid;
+    GLuint m_uploadedSamples = 0;
+    std::vector<GLfloat> m_heights; // upload scratch
+    std::vector<GLushort> m_texels;
+    // draw list rebuilt by update()
+    std::vector<GLsizei> m_drawCounts;
+    std::vector<const void*> m_drawOffsets;
+    std::vector<GLint> m_drawBaseVertices;
+
+    void uploadRegion(const GLuint& level, const GLint& x0, const GLint& z0, const GLuint& cols, const GLuint& rows);
+    void pushRows(const GLuint& level, const GLuint& row, const GLuint& col, const GLuint& rows, const GLuint& cols);
+};
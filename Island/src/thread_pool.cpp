@@ -0,0 +1,85 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount) : m_stop(false) {
+    for (unsigned int i = 1; i < threadCount; i++) {
+        m_workers.emplace_back([this] {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_condition.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+                    if (m_stop && m_jobs.empty())
+                        return;
+                    job = std::move(m_jobs.front());
+                    m_jobs.pop_front();
+                }
+                job();
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+void ThreadPool::parallelFor(unsigned int begin, unsigned int end, const std::function<void(unsigned int, unsigned int)>& task) {
+    if (end <= begin)
+        return;
+
+    // a few bands per thread, so that a slow band does not leave the other threads idle
+    unsigned int bandCount = std::min(end - begin, size() * 4);
+    unsigned int bandSize = (end - begin + bandCount - 1) / bandCount;
+    bandCount = (end - begin + bandSize - 1) / bandSize;
+
+    // read and written under doneMutex only: the last band notifies while holding it, so that this call cannot
+    // return and destroy the mutex and the condition before the band is done with them
+    unsigned int remaining = bandCount;
+    std::mutex doneMutex;
+    std::condition_variable done;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (unsigned int band = begin; band < end; band += bandSize) {
+            unsigned int bandEnd = std::min(band + bandSize, end);
+            m_jobs.emplace_back([&, band, bandEnd] {
+                task(band, bandEnd);
+                std::lock_guard<std::mutex> doneLock(doneMutex);
+                if (--remaining == 0)
+                    done.notify_all();
+            });
+        }
+    }
+    m_condition.notify_all();
+
+    // help the workers instead of just waiting
+    while (runPendingJob())
+        ;
+    std::unique_lock<std::mutex> doneLock(doneMutex);
+    done.wait(doneLock, [&] { return remaining == 0; });
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+bool ThreadPool::runPendingJob() {
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_jobs.empty())
+            return false;
+        job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+    }
+    job();
+    return true;
+}
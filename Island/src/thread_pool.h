@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/* Fixed set of worker threads used to split CPU heavy loading work (terrain mesh, normals...)
+into bands. The thread calling parallelFor() works on the bands too, so a pool of size 1
+simply runs everything on the calling thread. */
+class ThreadPool {
+public:
+    // threadCount includes the calling thread
+    ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    unsigned int size() const { return m_workers.size() + 1; }
+    // Splits [begin, end) into bands and runs task(bandBegin, bandEnd) for each of them, returns once all bands are done
+    void parallelFor(unsigned int begin, unsigned int end, const std::function<void(unsigned int, unsigned int)>& task);
+    // Pool shared by the whole application, one thread per core
+    static ThreadPool& shared();
+private:
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop;
+
+    bool runPendingJob();
+};
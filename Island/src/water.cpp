@@ -3,9 +3,12 @@
 #include <glm\gtc\matrix_transform.hpp>
 
 #include "resource_manager.h"
+#include "camera.h"
+#include "skybox.h"
 #include "water.h"
 
-Water::Water(const glm::vec2& size, const float& height) : m_size(size), m_height(height) {
+Water::Water(const glm::vec2& size, const float& height, const GLuint& screenWidth, const GLuint& screenHeight)
+    : m_size(size), m_height(height), m_screenWidth(screenWidth), m_screenHeight(screenHeight) {
     init_data();
     m_shader = ResourceManager::loadShader("shaders/water.vs", "shaders/water.fs", nullptr, "Water_shader");
     glm::mat4 model(1.0f);
@@ -15,11 +18,21 @@ Water::Water(const glm::vec2& size, const float& height) : m_size(size), m_heigh
     // Texture samplers
     m_shader.setInteger("refraction", 0);
     m_shader.setInteger("reflection", 2);
+    // SSR, set even when unused: the cube maps must not share a unit with the 2D samplers
+    m_shader.setInteger("sceneColor", 6);
+    m_shader.setInteger("sceneDepth", 7);
+    m_shader.setInteger("skyboxDiurnal", 8);
+    m_shader.setInteger("skyboxNocturnal", 9);
+    m_shader.setInteger("ssr", GL_FALSE);
 }
 
 Water::~Water() {
     glDeleteVertexArrays(1, &m_VAO);
     glDeleteBuffers(1, &m_VBO);
+    glDeleteFramebuffers(1, &m_refractionFBO);
+    glDeleteFramebuffers(1, &m_reflectionFBO);
+    glDeleteRenderbuffers(1, &m_RBO);
+    glDeleteQueries(1, &m_occlusionQuery);
 }
 
 void Water::load(std::string dudvMap, std::string normalMap, const float& scaleTex) {
@@ -34,6 +47,14 @@ void Water::load(std::string dudvMap, std::string normalMap, const float& scaleT
 }
 
 void Water::render() {
+    if (m_reflectionMode == WATER_REFLECTION_SSR)
+        captureScene();
+    // part of each texture filled by its pass, water.fs upsamples it to the screen
+    glm::ivec2 refraction = passViewport(m_texRefraction, m_refractionResolution);
+    glm::ivec2 reflection = passViewport(m_texReflection, m_reflectionResolution);
+    m_shader.use();
+    m_shader.setVector2f("refractionScale", (float)refraction.x / m_texRefraction.Width, (float)refraction.y / m_texRefraction.Height);
+    m_shader.setVector2f("reflectionScale", (float)reflection.x / m_texReflection.Width, (float)reflection.y / m_texReflection.Height);
     // Textures
     glActiveTexture(GL_TEXTURE0);
     m_texRefraction.bind();
@@ -43,40 +64,192 @@ void Water::render() {
     m_texReflection.bind();
     glActiveTexture(GL_TEXTURE3);
     m_normalMap.bind();
-    // Render
-    glBindVertexArray(m_VAO);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
+    if (m_reflectionMode == WATER_REFLECTION_SSR) {
+        glActiveTexture(GL_TEXTURE6);
+        m_texSceneColor.bind();
+        glActiveTexture(GL_TEXTURE7);
+        m_texSceneDepth.bind();
+        m_skybox->bindTextures(8, 9);
+        m_shader.setFloat("coeDiurnal", m_skybox->getCoeDiurnal());
+    }
+    // Render, with a new query once the previous one was read
+    bool query = !m_queryPending;
+    if (query)
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, m_occlusionQuery);
+    if (m_ocean)
+        m_ocean->render();
+    else {
+        glBindVertexArray(m_VAO);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glBindVertexArray(0);
+    }
+    if (query) {
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        m_queryPending = true;
+    }
+}
+
+bool Water::isVisible(const Plane* frustum) {
+    glm::vec3 corners[4] = {
+        glm::vec3(-0.5f * m_size.x, m_height, -0.5f * m_size.y), glm::vec3(0.5f * m_size.x, m_height, -0.5f * m_size.y),
+        glm::vec3(-0.5f * m_size.x, m_height,  0.5f * m_size.y), glm::vec3(0.5f * m_size.x, m_height,  0.5f * m_size.y)
+    };
+    for (GLuint i = 0; i < 6; i++) {
+        GLuint outside = 0;
+        for (GLuint j = 0; j < 4; j++)
+            outside += frustum[i].Distance(corners[j]) < 0.f;
+        if (outside == 4) {
+            // the last query says nothing about the water once it comes back in the frustum
+            m_occluded = false;
+            return false;
+        }
+    }
+
+    if (m_queryPending) {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(m_occlusionQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint anySamples = GL_TRUE;
+            glGetQueryObjectuiv(m_occlusionQuery, GL_QUERY_RESULT, &anySamples);
+            m_occluded = anySamples == GL_FALSE;
+            m_queryPending = false;
+        }
+    }
+    return !m_occluded;
 }
 
 void Water::initPassRefraction() {
-    glEnable(GL_CLIP_DISTANCE0);
-    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
-    glClearColor(0.18f, 0.2f, 0.18f, 1.0f);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texRefraction.ID, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    initPass(m_refractionFBO, m_texRefraction, m_refractionResolution);
 }
 
 void Water::terminatePassRefraction() {
-    glDisable(GL_CLIP_DISTANCE0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    terminatePass();
 }
 
 void Water::initPassReflection() {
     glFrontFace(GL_CW);// in reflection pass, camera is mirrored, so faces are mirrored too
+    initPass(m_reflectionFBO, m_texReflection, m_reflectionResolution);
+}
+
+void Water::terminatePassReflection() {
+    glFrontFace(GL_CCW);// in reflection pass, camera is mirrored, so faces are mirrored too
+    terminatePass();
+}
+
+void Water::setReflectionMode(const Water_Reflection& mode, Skybox* skybox) {
+    if (mode == WATER_REFLECTION_SSR && !skybox) {
+        std::cout << "ERROR::WATER: SSR reflections need a skybox to fall back to" << std::endl;
+        return;
+    }
+    m_reflectionMode = mode;
+    m_skybox = skybox;
+    if (mode == WATER_REFLECTION_SSR && m_texSceneColor.Width == 0) {
+        // screen sized copies, read at the exact pixels: no filtering
+        m_texSceneColor.Mipmap = false;
+        m_texSceneColor.Internal_Format = GL_RGB;
+        m_texSceneColor.Filter_Min = m_texSceneColor.Filter_Max = GL_NEAREST;
+        m_texSceneColor.Wrap_S = m_texSceneColor.Wrap_T = GL_CLAMP_TO_EDGE;
+        m_texSceneColor.generate(m_screenWidth, m_screenHeight, NULL);
+
+        m_texSceneDepth.Mipmap = false;
+        m_texSceneDepth.Internal_Format = GL_DEPTH_COMPONENT24;
+        m_texSceneDepth.Image_Format = GL_DEPTH_COMPONENT;
+        m_texSceneDepth.Filter_Min = m_texSceneDepth.Filter_Max = GL_NEAREST;
+        m_texSceneDepth.Wrap_S = m_texSceneDepth.Wrap_T = GL_CLAMP_TO_EDGE;
+        m_texSceneDepth.generate(m_screenWidth, m_screenHeight, NULL);
+    }
+    m_shader.setInteger("ssr", mode == WATER_REFLECTION_SSR, true);
+}
+
+void Water::setSurface(const Water_Surface& surface) {
+    if (surface == WATER_SURFACE_FLAT)
+        m_ocean.reset();
+    else if (!m_ocean) {
+        // enough levels for the grid to cover the whole water from any point of it
+        const GLfloat spacing = 0.5f;
+        GLuint levels = 1;
+        while (OCEAN_GRID_SIZE / 2 * spacing * (1u << (levels - 1)) < glm::max(m_size.x, m_size.y) && levels < OCEAN_GRID_LEVELS_MAX)
+            levels++;
+        m_ocean.reset(new Ocean(64.f, glm::vec2(8.f, 3.f), 0.2f, 1.5f, spacing, levels));
+    }
+    m_shader.use();
+    m_shader.setInteger("ocean.enabled", surface == WATER_SURFACE_FFT);
+    m_shader.setVector2f("ocean.halfSize", m_size * 0.5f);
+    m_shader.setFloat("ocean.height", m_height);
+}
+
+void Water::update(const float& time, const glm::vec3& cameraPosition) {
+    if (!m_ocean)
+        return;
+    m_ocean->simulate(time);
+    m_ocean->update(cameraPosition);
+    m_ocean->setShader(m_shader, "ocean", true);
+}
+
+void Water::setRefractionResolution(const Water_Resolution& resolution) {
+    m_refractionResolution = resolution;
+    resizeTargets();
+}
+
+void Water::setReflectionResolution(const Water_Resolution& resolution) {
+    m_reflectionResolution = resolution;
+    resizeTargets();
+}
+
+void Water::updateDynamicResolution(const float& frameTime) {
+    // small steps with a dead zone, so that the scale does not oscillate from one frame to the next
+    if (frameTime > m_targetFrameTime * 1.05f)
+        m_dynamicScale -= 0.05f;
+    else if (frameTime < m_targetFrameTime * 0.9f)
+        m_dynamicScale += 0.05f;
+    m_dynamicScale = glm::clamp(glm::round(m_dynamicScale * 20.f) / 20.f, 0.25f, 1.f);
+}
+
+void Water::initPass(const GLuint& FBO, const Texture2D& texture, const Water_Resolution& resolution) {
     glEnable(GL_CLIP_DISTANCE0);
-    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
     glClearColor(0.18f, 0.2f, 0.18f, 1.0f);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texReflection.ID, 0);
+    glm::ivec2 viewport = passViewport(texture, resolution);
+    glViewport(0, 0, viewport.x, viewport.y);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
-void Water::terminatePassReflection() {
-    glFrontFace(GL_CCW);// in reflection pass, camera is mirrored, so faces are mirrored too
+void Water::terminatePass() {
     glDisable(GL_CLIP_DISTANCE0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // no clear here, the default framebuffer is cleared once by the pass that renders to it
+    glViewport(0, 0, m_screenWidth, m_screenHeight);
+}
+
+// Copies the screen as it is before the water: the color and depth of the bound (read) framebuffer
+void Water::captureScene() {
+    m_texSceneColor.bind();
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, m_screenWidth, m_screenHeight);
+    m_texSceneDepth.bind();
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, m_screenWidth, m_screenHeight);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+glm::ivec2 Water::passViewport(const Texture2D& texture, const Water_Resolution& resolution) {
+    if (resolution != WATER_RESOLUTION_DYNAMIC)
+        return glm::ivec2(texture.Width, texture.Height);
+    return glm::max(glm::ivec2(glm::vec2(texture.Width, texture.Height) * m_dynamicScale), glm::ivec2(1));
+}
+
+// (Re)allocates both textures and the shared depth buffer for the current resolutions.
+// The framebuffers keep the same objects attached, so they stay valid without being touched
+void Water::resizeTargets() {
+    GLuint divisors[] = { 1, 2, 4, 1 }; // dynamic passes get the full resolution and only use a part of it
+    GLuint refractionWidth = glm::max(m_screenWidth / divisors[m_refractionResolution], 1u);
+    GLuint refractionHeight = glm::max(m_screenHeight / divisors[m_refractionResolution], 1u);
+    GLuint reflectionWidth = glm::max(m_screenWidth / divisors[m_reflectionResolution], 1u);
+    GLuint reflectionHeight = glm::max(m_screenHeight / divisors[m_reflectionResolution], 1u);
+    m_texRefraction.generate(refractionWidth, refractionHeight, NULL);
+    m_texReflection.generate(reflectionWidth, reflectionHeight, NULL);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, m_RBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, glm::max(refractionWidth, reflectionWidth), glm::max(refractionHeight, reflectionHeight));
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
 }
 
 void Water::init_data() {
@@ -104,33 +277,36 @@ void Water::init_data() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    // generate framebuffer
-    glGenFramebuffers(1, &m_FBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
-
     // Initialize Textures (for FBO colorbuffers)
-    // create a color attachment texture
-
+    // create a color attachment texture, upsampled with bilinear filtering by water.fs
     m_texRefraction.Mipmap = false;
     m_texRefraction.Internal_Format = GL_RGB;
     m_texRefraction.Filter_Min = GL_LINEAR;
-    m_texRefraction.generate(1280, 720, NULL);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texRefraction.ID, 0);
+    m_texRefraction.Wrap_S = m_texRefraction.Wrap_T = GL_CLAMP_TO_EDGE;
 
     m_texReflection.Mipmap = false;
     m_texReflection.Internal_Format = GL_RGB;
     m_texReflection.Filter_Min = GL_LINEAR;
-    m_texReflection.generate(1280, 720, NULL);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texReflection.ID, 0);
+    m_texReflection.Wrap_S = m_texReflection.Wrap_T = GL_CLAMP_TO_EDGE;
 
     glGenRenderbuffers(1, &m_RBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, m_RBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 1280, 720);
+    resizeTargets();
+    glGenQueries(1, &m_occlusionQuery);
+
+    // generate framebuffers, attached once for all
+    glGenFramebuffers(1, &m_refractionFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_refractionFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texRefraction.ID, 0);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_RBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR:FRAMEBUFFER: WATER REFRACTION!" << std::endl;
 
+    glGenFramebuffers(1, &m_reflectionFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_reflectionFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texReflection.ID, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_RBO);
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "ERROR:FRAMEBUFFER: WATER!" << std::endl;
+        std::cout << "ERROR:FRAMEBUFFER: WATER REFLECTION!" << std::endl;
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
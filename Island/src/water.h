@@ -1,18 +1,47 @@
 #pragma once
 
+#include <memory>
+
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "shader.h"
 #include "texture.h"
+#include "ocean.h"
+
+struct Plane;
+class Skybox;
+
+// Resolution of the refraction / reflection textures relative to the screen
+enum Water_Resolution {
+	WATER_RESOLUTION_FULL,
+	WATER_RESOLUTION_HALF,
+	WATER_RESOLUTION_QUARTER,
+	WATER_RESOLUTION_DYNAMIC // full size texture, only a part of it is rendered, see updateDynamicResolution()
+};
+
+enum Water_Reflection {
+	WATER_REFLECTION_PLANAR, // rendered from the mirrored camera by the reflection pass
+	WATER_REFLECTION_SSR // ray marched in the color & depth of the normal pass, the sky where the rays miss: no reflection pass
+};
+
+enum Water_Surface {
+	WATER_SURFACE_FLAT, // quad with a scrolling dudv map
+	WATER_SURFACE_FFT // Tessendorf waves on a LOD grid around the camera, see Ocean
+};
 
 class Water {
 public:
-	Water(const glm::vec2& size, const float& m_height);
+	Water(const glm::vec2& size, const float& m_height, const GLuint& screenWidth = 1280, const GLuint& screenHeight = 720);
 	~Water();
 	void load(std::string dudvMap, std::string normalMap, const float& scaleTex);
+	// Also counts the visible samples of the water for isVisible(), so call it after the occluders (terrain).
+	// With SSR, first copies the color & depth of the bound framebuffer, so call it after everything the water reflects
 	void render();
+	// False when the water is out of the frustum, or was fully hidden the last time the GPU reported it,
+	// in which case the refraction and reflection passes can be skipped. Never waits for the GPU
+	bool isVisible(const Plane* frustum);
 
 	void initPassRefraction();
 	void terminatePassRefraction();
@@ -20,17 +49,55 @@ public:
 	void initPassReflection();
 	void terminatePassReflection();
 
+	// Quality settings, each pass can have its own resolution
+	void setRefractionResolution(const Water_Resolution& resolution);
+	void setReflectionResolution(const Water_Resolution& resolution);
+	// Scales the passes set to WATER_RESOLUTION_DYNAMIC between a quarter and the full resolution,
+	// so that frameTime (seconds) stays close to the target frame time. To be called once per frame
+	void updateDynamicResolution(const float& frameTime);
+	void setTargetFrameTime(const float& targetFrameTime) { m_targetFrameTime = targetFrameTime; }
+	float getDynamicScale() { return m_dynamicScale; }
+
+	// skybox: the sky sampled where the SSR rays miss, needed by WATER_REFLECTION_SSR
+	void setReflectionMode(const Water_Reflection& mode, Skybox* skybox = nullptr);
+	Water_Reflection getReflectionMode() { return m_reflectionMode; }
+
+	void setSurface(const Water_Surface& surface);
+	// Advances the FFT surface to time (seconds) and recenters its grid on the camera, nothing to do for a flat surface
+	void update(const float& time, const glm::vec3& cameraPosition);
+	Ocean* getOcean() { return m_ocean.get(); }
+
 	float getHeight() { return m_height; }
 	glm::vec2 getSize() { return m_size; };
 
-	GLuint m_VAO, m_VBO, m_FBO, m_RBO;
+	// one framebuffer per target, the color textures stay attached. Both use the same depth buffer
+	GLuint m_VAO, m_VBO, m_refractionFBO, m_reflectionFBO, m_RBO;
 	Texture2D m_texRefraction, m_texReflection, m_dudvMap, m_normalMap;
+	// SSR: the screen before the water is drawn
+	Texture2D m_texSceneColor, m_texSceneDepth;
 	Shader m_shader;
 
 private:
 	glm::vec2 m_size;
 	float m_height;
 	float m_scaleTex;
+	GLuint m_screenWidth, m_screenHeight;
+	// GL_ANY_SAMPLES_PASSED query of render(), read a frame or more later
+	GLuint m_occlusionQuery;
+	bool m_queryPending = false;
+	bool m_occluded = false;
+	Water_Resolution m_refractionResolution = WATER_RESOLUTION_FULL, m_reflectionResolution = WATER_RESOLUTION_FULL;
+	float m_dynamicScale = 1.f;
+	float m_targetFrameTime = 1.f / 60.f;
+	Water_Reflection m_reflectionMode = WATER_REFLECTION_PLANAR;
+	Skybox* m_skybox = nullptr;
+	std::unique_ptr<Ocean> m_ocean;
 
 	void init_data();
+	void resizeTargets();
+	// part of the texture a pass renders to, in pixels
+	glm::ivec2 passViewport(const Texture2D& texture, const Water_Resolution& resolution);
+	void initPass(const GLuint& FBO, const Texture2D& texture, const Water_Resolution& resolution);
+	void terminatePass();
+	void captureScene();
 };